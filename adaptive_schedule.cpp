@@ -0,0 +1,71 @@
+#include "adaptive_schedule.hpp"
+
+#include <algorithm>
+
+AdaptiveSchedule::AdaptiveSchedule(int numDownscales, int maxShDegree, int maxStepsPerLevel, int maxStepsPerShDegree,
+                                   int window, float plateauThresh) :
+    level((std::max)(numDownscales, 0)), degree(0), maxShDegree(maxShDegree),
+    maxStepsPerLevel(maxStepsPerLevel), maxStepsPerShDegree(maxStepsPerShDegree),
+    window((std::max)(window, 1)), plateauThresh(plateauThresh) {}
+
+void AdaptiveSchedule::update(int step, float loss){
+    // Exponential moving average with a span of one window
+    const double alpha = 2.0 / (window + 1.0);
+    ema = emaSamples == 0 ? loss : ema + alpha * (loss - ema);
+    emaSamples++;
+
+    if (level > 0 && step - levelStart >= maxStepsPerLevel){
+        advance(step, true, false);
+        return;
+    }
+    if (degree < maxShDegree && step - degreeStart >= maxStepsPerShDegree){
+        advance(step, false, false);
+        return;
+    }
+
+    if (emaSamples % window == 0){
+        // Relative improvement of the smoothed loss over the last window;
+        // the first window only warms up the average
+        if (lastCheckEma > 0.0){
+            double improvement = (lastCheckEma - ema) / lastCheckEma;
+            if (improvement < plateauThresh){
+                if (level > 0) advance(step, true, true);
+                else if (degree < maxShDegree) advance(step, false, true);
+                return;
+            }
+        }
+        lastCheckEma = ema;
+    }
+}
+
+void AdaptiveSchedule::advance(int step, bool resolution, bool plateau){
+    if (resolution){
+        level--;
+        levelStart = step;
+    }else{
+        degree++;
+        degreeStart = step;
+    }
+
+    // The loss of the new stage is not comparable with the previous one
+    emaSamples = 0;
+    lastCheckEma = 0.0;
+
+    Transition t{ step, resolution, resolution ? (1 << level) : degree, plateau };
+    transitions.push_back(t);
+    log(t);
+}
+
+void AdaptiveSchedule::log(const Transition &t) const{
+    std::cout << "Step " << t.step << ": " << (t.resolution ? "downscale factor " : "SH degree ") << t.value
+              << (t.plateau ? " (loss plateau)" : " (step limit)") << std::endl;
+}
+
+void AdaptiveSchedule::printSummary() const{
+    std::cout << "Adaptive schedule:" << std::endl;
+    if (transitions.empty()) std::cout << "  no transitions" << std::endl;
+    for (const Transition &t : transitions){
+        std::cout << "  ";
+        log(t);
+    }
+}
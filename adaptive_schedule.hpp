@@ -0,0 +1,50 @@
+#ifndef ADAPTIVE_SCHEDULE_H
+#define ADAPTIVE_SCHEDULE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Moves to the next image resolution, then to the next spherical harmonics
+// degree, when the smoothed training loss stops improving. maxStepsPerLevel and
+// maxStepsPerShDegree cap the number of steps spent on each stage, so the
+// schedule is never slower than the fixed one.
+class AdaptiveSchedule{
+public:
+    AdaptiveSchedule(int numDownscales, int maxShDegree, int maxStepsPerLevel, int maxStepsPerShDegree,
+                     int window, float plateauThresh);
+
+    void update(int step, float loss);
+    int downscaleFactor() const { return 1 << level; }
+    int shDegree() const { return degree; }
+    void printSummary() const;
+private:
+    struct Transition{
+        int step;
+        bool resolution;
+        int value;
+        bool plateau;
+    };
+
+    void advance(int step, bool resolution, bool plateau);
+    void log(const Transition &t) const;
+
+    int level;
+    int degree;
+    int maxShDegree;
+    int maxStepsPerLevel;
+    int maxStepsPerShDegree;
+    int window;
+    float plateauThresh;
+
+    int levelStart = 0;
+    int degreeStart = 0;
+
+    double ema = 0.0;
+    double lastCheckEma = 0.0;
+    int emaSamples = 0;
+
+    std::vector<Transition> transitions;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "camera_bank.hpp"
+
+using namespace torch::indexing;
+
+torch::Tensor projectionMatrix(float zNear, float zFar, float fovX, float fovY, const torch::Device &device){
+    // OpenGL perspective projection matrix
+    float t = zNear * std::tan(0.5f * fovY);
+    float b = -t;
+    float r = zNear * std::tan(0.5f * fovX);
+    float l = -r;
+    return torch::tensor({
+        {2.0f * zNear / (r - l), 0.0f, (r + l) / (r - l), 0.0f},
+        {0.0f, 2 * zNear / (t - b), (t + b) / (t - b), 0.0f},
+        {0.0f, 0.0f, (zFar + zNear) / (zFar - zNear), -1.0f * zFar * zNear / (zFar - zNear)},
+        {0.0f, 0.0f, 1.0f, 0.0f}
+    }, device);
+}
+
+void CameraBank::imageSize(const Camera &cam, int downscaleFactor, int &height, int &width){
+    const float scaleFactor = static_cast<float>(downscaleFactor);
+    height = static_cast<int>(static_cast<float>(cam.height) / scaleFactor);
+    width = static_cast<int>(static_cast<float>(cam.width) / scaleFactor);
+}
+
+CameraConstants CameraBank::compute(const Camera &cam, int downscaleFactor, const torch::Device &device){
+    const float scaleFactor = static_cast<float>(downscaleFactor);
+    CameraConstants c;
+    c.fx = cam.fx / scaleFactor;
+    c.fy = cam.fy / scaleFactor;
+    c.cx = cam.cx / scaleFactor;
+    c.cy = cam.cy / scaleFactor;
+    imageSize(cam, downscaleFactor, c.height, c.width);
+
+    torch::Tensor R = cam.camToWorld.index({Slice(None, 3), Slice(None, 3)});
+    torch::Tensor T = cam.camToWorld.index({Slice(None, 3), Slice(3,4)});
+
+    // Flip the z and y axes to align with gsplat conventions
+    R = torch::matmul(R, torch::diag(torch::tensor({1.0f, -1.0f, -1.0f}, R.device())));
+
+    // worldToCam
+    torch::Tensor Rinv = R.transpose(0, 1);
+    torch::Tensor Tinv = torch::matmul(-Rinv, T);
+
+    c.viewMat = torch::eye(4, device);
+    c.viewMat.index_put_({Slice(None, 3), Slice(None, 3)}, Rinv);
+    c.viewMat.index_put_({Slice(None, 3), Slice(3, 4)}, Tinv);
+
+    float fovX = 2.0f * std::atan(c.width / (2.0f * c.fx));
+    float fovY = 2.0f * std::atan(c.height / (2.0f * c.fy));
+
+    c.projMat = torch::matmul(projectionMatrix(0.001f, 1000.0f, fovX, fovY, device), c.viewMat);
+    c.center = T.transpose(0, 1).to(device);
+
+    return c;
+}
+
+void CameraBank::build(const std::vector<Camera> &cameras, int numDownscales, const torch::Device &device){
+    torch::NoGradGuard noGrad;
+
+    const long long numCameras = static_cast<long long>(cameras.size());
+    numLevels = (std::max)(numDownscales, 0) + 1;
+
+    torch::TensorOptions opts = torch::TensorOptions().dtype(torch::kFloat32).device(device);
+    viewMats = torch::empty({numCameras, numLevels, 4, 4}, opts);
+    projMats = torch::empty({numCameras, numLevels, 4, 4}, opts);
+    centers = torch::empty({numCameras, 1, 3}, opts);
+    entries.clear();
+    entries.reserve(numCameras * numLevels);
+    cameraSlots.clear();
+
+    for (long long i = 0; i < numCameras; i++){
+        const Camera &cam = cameras[i];
+        cameraSlots[cam.camToWorld.data_ptr()] = static_cast<size_t>(i);
+
+        for (int level = 0; level < numLevels; level++){
+            CameraConstants c = compute(cam, 1 << level, device);
+            viewMats.index({i, level}).copy_(c.viewMat);
+            projMats.index({i, level}).copy_(c.projMat);
+            if (level == 0) centers.index({i}).copy_(c.center);
+
+            c.viewMat = viewMats.index({i, level});
+            c.projMat = projMats.index({i, level});
+            c.center = centers.index({i});
+            entries.push_back(c);
+        }
+    }
+}
+
+const CameraConstants *CameraBank::find(const Camera &cam, int downscaleFactor) const{
+    if (!cam.camToWorld.defined()) return nullptr;
+    auto it = cameraSlots.find(cam.camToWorld.data_ptr());
+    if (it == cameraSlots.end()) return nullptr;
+
+    int level = 0;
+    while ((1 << level) < downscaleFactor) level++;
+    if ((1 << level) != downscaleFactor || level >= numLevels) return nullptr;
+
+    return &entries[it->second * numLevels + level];
+}
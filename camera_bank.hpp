@@ -0,0 +1,47 @@
+#ifndef CAMERA_BANK_H
+#define CAMERA_BANK_H
+
+#include <unordered_map>
+#include <vector>
+#include <torch/torch.h>
+#include "input_data.hpp"
+
+torch::Tensor projectionMatrix(float zNear, float zFar, float fovX, float fovY, const torch::Device &device);
+
+// Everything the renderer needs to know about a camera
+// at a given downscale factor
+struct CameraConstants{
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+    int width;
+    int height;
+    torch::Tensor viewMat; // 4x4 world to camera
+    torch::Tensor projMat; // 4x4 full projection (projection * view)
+    torch::Tensor center;  // 1x3 camera position in world space
+};
+
+// Precomputes the constants of each camera at each downscale level.
+// Matrices of all cameras live in a single contiguous tensor per kind;
+// lookups return views into them without allocating.
+class CameraBank{
+public:
+    void build(const std::vector<Camera> &cameras, int numDownscales, const torch::Device &device);
+
+    // Returns nullptr if the camera/downscale factor is not in the bank
+    const CameraConstants *find(const Camera &cam, int downscaleFactor) const;
+
+    static CameraConstants compute(const Camera &cam, int downscaleFactor, const torch::Device &device);
+    // Size of the images of cam at downscaleFactor
+    static void imageSize(const Camera &cam, int downscaleFactor, int &height, int &width);
+private:
+    torch::Tensor viewMats; // [cameras, levels, 4, 4]
+    torch::Tensor projMats; // [cameras, levels, 4, 4]
+    torch::Tensor centers;  // [cameras, 1, 3]
+    std::vector<CameraConstants> entries;
+    std::unordered_map<const void *, size_t> cameraSlots;
+    int numLevels = 0;
+};
+
+#endif
@@ -25,6 +25,7 @@ InputData inputDataFromColmap(const std::string &projectRoot){
     if (!fs::exists(camerasPath)) throw std::runtime_error(camerasPath.string() + " does not exist");
     if (!fs::exists(imagesPath)) throw std::runtime_error(imagesPath.string() + " does not exist");
     if (!fs::exists(pointsPath)) throw std::runtime_error(pointsPath.string() + " does not exist");
+    ret.sourceFiles = { camerasPath.string(), imagesPath.string(), pointsPath.string() };
 
     std::ifstream camf(camerasPath.string(), std::ios::binary);
     if (!camf.is_open()) throw std::runtime_error("Cannot open " + camerasPath.string());
@@ -144,6 +145,8 @@ InputData inputDataFromColmap(const std::string &projectRoot){
 
     ret.points.xyz = (points - ret.translation) * ret.scale;
     ret.points.rgb = pSet->colorsTensor().clone();
+    ret.points.error = torch::from_blob(pSet->errors.data(), { static_cast<long int>(pSet->errors.size()) }, torch::kFloat32).clone();
+    ret.points.trackLength = torch::from_blob(pSet->trackLengths.data(), { static_cast<long int>(pSet->trackLengths.size()) }, torch::kInt32).clone();
 
     RELEASE_POINTSET(pSet);
 
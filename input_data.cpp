@@ -1,10 +1,13 @@
 #include <filesystem>
 #include "input_data.hpp"
 #include "cv_utils.hpp"
+#include "gsplat.hpp"
 #include <tinyply.h>
 #include <memory>
 #include <fstream>
 #include <cstring>
+#include <numeric>
+#include <algorithm>
 
 namespace fs = std::filesystem;
 using namespace torch::indexing;
@@ -122,6 +125,36 @@ InputData inputDataFromX(const std::string &projectRoot, const std::string& mesh
     }
 }
 
+std::tuple<std::vector<Camera>, std::vector<Camera>> splitHoldout(const std::vector<Camera> &cameras, int holdoutEvery, const std::vector<std::string> &holdoutList){
+    std::vector<size_t> order(cameras.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&cameras](size_t a, size_t b){
+        return cameras[a].filePath < cameras[b].filePath;
+    });
+
+    std::vector<bool> heldOut(cameras.size(), false);
+    for (size_t k = 0; k < order.size(); k++){
+        if (holdoutEvery > 0 && k % holdoutEvery == 0) heldOut[order[k]] = true;
+    }
+    for (const std::string &name : holdoutList){
+        bool found = false;
+        for (size_t i = 0; i < cameras.size(); i++){
+            if (fs::path(cameras[i].filePath).filename().string() == name){
+                heldOut[i] = true;
+                found = true;
+            }
+        }
+        if (!found) throw std::runtime_error(name + " not in the list of cameras");
+    }
+
+    std::vector<Camera> train, test;
+    for (size_t i = 0; i < cameras.size(); i++){
+        if (heldOut[i]) test.push_back(cameras[i]);
+        else train.push_back(cameras[i]);
+    }
+    return std::make_tuple(train, test);
+}
+
 torch::Tensor Camera::getIntrinsicsMatrix(){
     return torch::tensor({{fx, 0.0f, cx},
                           {0.0f, fy, cy},
@@ -154,56 +187,133 @@ void Camera::loadImage(float downscaleFactor, const bool& changeImgFormat){
     }
 
     K = getIntrinsicsMatrix();
+    sourceK = K;
+    loadedDownscale = downscaleFactor;
+    loadedChangeFormat = changeImgFormat;
+    image = undistortImage(cImg);
+
+    // Update parameters
+    height = image.size(0);
+    width = image.size(1);
+    fx = K[0][0].item<float>();
+    fy = K[1][1].item<float>();
+    cx = K[0][2].item<float>();
+    cy = K[1][2].item<float>();
+}
+
+torch::Tensor Camera::undistortImage(const cv::Mat &cImg){
     cv::Rect roi;
+    torch::Tensor t;
 
     if (hasDistortionParameters()){
         // Undistort
         std::vector<float> distCoeffs = undistortionParameters();
-        cv::Mat cK = floatNxNtensorToMat(K);
+        cv::Mat cK = floatNxNtensorToMat(sourceK);
         cv::Mat newK = cv::getOptimalNewCameraMatrix(cK, distCoeffs, cv::Size(cImg.cols, cImg.rows), 0, cv::Size(), &roi);
 
         cv::Mat undistorted = cv::Mat::zeros(cImg.rows, cImg.cols, cImg.type());
         cv::undistort(cImg, undistorted, cK, distCoeffs, newK);
         
-        image = imageToTensor(undistorted);
+        t = imageToTensor(undistorted);
         K = floatNxNMatToTensor(newK);
     }else{
         roi = cv::Rect(0, 0, cImg.cols, cImg.rows);
-        image = imageToTensor(cImg);
+        t = imageToTensor(cImg);
     }
 
     // Crop to ROI
-    image = image.index({Slice(roi.y, roi.y + roi.height), Slice(roi.x, roi.x + roi.width), Slice()});
+    return t.index({Slice(roi.y, roi.y + roi.height), Slice(roi.x, roi.x + roi.width), Slice()});
+}
 
-    // Update parameters
-    height = image.size(0);
-    width = image.size(1);
-    fx = K[0][0].item<float>();
-    fy = K[1][1].item<float>();
-    cx = K[0][2].item<float>();
-    cy = K[1][2].item<float>();
+torch::Tensor Camera::decodeImage(){
+    cv::Mat cImg = imreadRGB(filePath, loadedChangeFormat);
+    if (loadedDownscale > 1.0f){
+        float f = 1.0f / loadedDownscale;
+        cv::resize(cImg, cImg, cv::Size(), f, f, cv::INTER_AREA);
+    }
+    return undistortImage(cImg);
 }
 
 torch::Tensor Camera::getImage(int downscaleFactor){
+    auto it = imagePyramids.find(downscaleFactor);
+    if (downscaleFactor > 1 && it != imagePyramids.end()) return it->second;
+
+    // Released by keepLevel
+    if (!image.defined() && sourceK.defined()) image = decodeImage();
+
     if (downscaleFactor <= 1) return image;
     else{
 
         // torch::jit::script::Module container = torch::jit::load("gt.pt");
         // return container.attr("val").toTensor();
 
-        if (imagePyramids.find(downscaleFactor) != imagePyramids.end()){
-            return imagePyramids[downscaleFactor];
-        }
-
         // Rescale, store and return
-        cv::Mat cImg = tensorToImage(image);
-        cv::resize(cImg, cImg, cv::Size(cImg.cols / downscaleFactor, cImg.rows / downscaleFactor), 0.0, 0.0, cv::INTER_AREA);
-        torch::Tensor t = imageToTensor(cImg);
+        torch::Tensor t = downscaleImage(downscaleFactor);
         imagePyramids[downscaleFactor] = t;
         return t;
     }
 }
 
+torch::Tensor Camera::downscaleImage(int downscaleFactor){
+    cv::Mat cImg = tensorToImage(image);
+    cv::resize(cImg, cImg, cv::Size(cImg.cols / downscaleFactor, cImg.rows / downscaleFactor), 0.0, 0.0, cv::INTER_AREA);
+    return imageToTensor(cImg);
+}
+
+torch::Tensor Camera::getTiledImage(int downscaleFactor){
+    int level = (std::max)(downscaleFactor, 1);
+    auto it = tiledPyramids.find(level);
+    if (it != tiledPyramids.end()) return it->second;
+
+    // The planar level is not cached, only the full resolution image it is
+    // resized from
+    torch::Tensor t;
+    auto planar = imagePyramids.find(level);
+    if (planar != imagePyramids.end()) t = image_to_tile_major(planar->second);
+    else{
+        if (!image.defined() && sourceK.defined()) image = decodeImage();
+        t = image_to_tile_major(level > 1 ? downscaleImage(level) : image);
+    }
+    tiledPyramids[level] = t;
+    return t;
+}
+
+size_t Camera::evictPyramids(int keepLevel){
+    size_t bytes = 0;
+    for (auto *levels : { &imagePyramids, &tiledPyramids }){
+        for (auto it = levels->begin(); it != levels->end();){
+            if (it->first == keepLevel){
+                it++;
+                continue;
+            }
+            bytes += it->second.nbytes();
+            it = levels->erase(it);
+        }
+    }
+    return bytes;
+}
+
+size_t Camera::keepLevel(int downscaleFactor, bool tiled){
+    const int level = (std::max)(downscaleFactor, 1);
+    if (tiled) getTiledImage(level);
+    else getImage(level);
+
+    size_t bytes = evictPyramids(level);
+    if (tiled){
+        // Only the tiled copy is used for training
+        auto planar = imagePyramids.find(level);
+        if (planar != imagePyramids.end()){
+            bytes += planar->second.nbytes();
+            imagePyramids.erase(planar);
+        }
+    }
+    if (level > 1 || tiled){
+        bytes += image.nbytes();
+        image = torch::Tensor();
+    }
+    return bytes;
+}
+
 bool Camera::hasDistortionParameters(){
     return k1 != 0.0f || k2 != 0.0f || k3 != 0.0f || p1 != 0.0f || p2 != 0.0f;
 }
@@ -213,6 +323,23 @@ std::vector<float> Camera::undistortionParameters(){
     return p;
 }
 
+void InputData::filterPoints(float maxError, int minTrackLength){
+    if (!points.error.defined() || (maxError <= 0.0f && minTrackLength <= 0)) return;
+
+    torch::Tensor keep = torch::ones({ points.xyz.size(0) }, torch::kBool);
+    if (maxError > 0.0f) keep &= points.error <= maxError;
+    if (minTrackLength > 0) keep &= points.trackLength >= minTrackLength;
+
+    const int64_t numKept = keep.sum().item<int64_t>();
+    if (numKept == 0) throw std::runtime_error("No points left after filtering by reprojection error and track length");
+    std::cout << "Keeping " << numKept << " of " << points.xyz.size(0) << " points" << std::endl;
+
+    points.xyz = points.xyz.index({keep});
+    points.rgb = points.rgb.index({keep});
+    points.error = points.error.index({keep});
+    points.trackLength = points.trackLength.index({keep});
+}
+
 std::tuple<std::vector<Camera>, Camera *> InputData::getCameras(bool validate, const std::string &valImage){
     if (!validate) return std::make_tuple(cameras, nullptr);
     else{
@@ -39,12 +39,35 @@ struct Camera{
     bool hasDistortionParameters();
     std::vector<float> undistortionParameters();
     torch::Tensor getImage(int downscaleFactor);
+    // Same as getImage, in the tile-major layout of the CPU rasterizer
+    torch::Tensor getTiledImage(int downscaleFactor);
+    // Drops the cached images of downscale factors other than keepLevel,
+    // returns the number of bytes released
+    size_t evictPyramids(int keepLevel);
+    // Keeps only the image of downscaleFactor (only in the tile-major layout if
+    // tiled), releasing the full resolution image if it is not needed. It is
+    // read again from disk by getImage when a finer level is requested.
+    // Returns the number of bytes released
+    size_t keepLevel(int downscaleFactor, bool tiled);
 
     void loadImage(float downscaleFactor, const bool& changeImgFormat = true);
     torch::Tensor K;
     torch::Tensor image;
 
     std::unordered_map<int, torch::Tensor> imagePyramids;
+    std::unordered_map<int, torch::Tensor> tiledPyramids;
+
+private:
+    torch::Tensor undistortImage(const cv::Mat &cImg);
+    torch::Tensor decodeImage();
+    // Resizes the full resolution image, without caching
+    torch::Tensor downscaleImage(int downscaleFactor);
+
+    // Intrinsics of the decoded image (before undistortion) and
+    // arguments of loadImage, to decode it again
+    torch::Tensor sourceK;
+    float loadedDownscale = 1.0f;
+    bool loadedChangeFormat = true;
 };
 
 struct MeshConstraintRaw {
@@ -67,6 +90,11 @@ struct Points{
     torch::Tensor xyz;
     torch::Tensor rgb;
 
+    // COLMAP only (undefined otherwise): reprojection error in pixels and
+    // number of images that observe each point
+    torch::Tensor error;
+    torch::Tensor trackLength;
+
     std::shared_ptr<MeshConstraint> mesh = nullptr;
 };
 struct InputData{
@@ -75,11 +103,20 @@ struct InputData{
     torch::Tensor translation;
     Points points;
     std::array<float, 3> backgroundColor;
+    std::vector<std::string> sourceFiles; // files read to build cameras and points (not the images)
 
     std::tuple<std::vector<Camera>, Camera *> getCameras(bool validate, const std::string &valImage = "random");
+
+    // Drops the points with a reprojection error above maxError (if > 0) or
+    // seen by fewer than minTrackLength images. Only COLMAP points carry these
+    void filterPoints(float maxError, int minTrackLength);
 };
 InputData inputDataFromX(const std::string &projectRoot, const std::string& meshInput);
 
+// Splits cameras into (training, held-out). Sorted by filename, every holdoutEvery-th
+// camera (if > 0) is held out, as well as cameras whose filename is in holdoutList
+std::tuple<std::vector<Camera>, std::vector<Camera>> splitHoldout(const std::vector<Camera> &cameras, int holdoutEvery, const std::vector<std::string> &holdoutList);
+
 std::shared_ptr<MeshConstraintRaw> loadMeshConstraint(const std::string& fileName);
 
 #endif
\ No newline at end of file
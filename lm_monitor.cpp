@@ -0,0 +1,38 @@
+#include "lm_monitor.hpp"
+
+#include <iostream>
+
+bool LmMonitor::update(const LmResult &r, double adamSeconds, double lmSeconds){
+    steps++;
+    if (r.accepted) accepted++;
+    totalLmGain += r.psnrAfter - r.psnrBefore;
+    totalLmTime += lmSeconds;
+
+    const bool measured = hasPrevious;
+    if (measured){
+        samples++;
+        lmGain += r.psnrAfter - r.psnrBefore;
+        lmTime += lmSeconds;
+        adamGain += r.psnrBefore - previousPsnr;
+        adamTime += adamSeconds;
+        totalAdamGain += r.psnrBefore - previousPsnr;
+        totalAdamTime += adamSeconds;
+    }
+    hasPrevious = true;
+    previousPsnr = r.psnrAfter;
+
+    if (!measured || samples < window) return false;
+
+    lastLmRate = lmTime > 0.0 ? lmGain / lmTime : 0.0;
+    lastAdamRate = adamTime > 0.0 ? adamGain / adamTime : 0.0;
+    samples = 0;
+    lmGain = lmTime = adamGain = adamTime = 0.0;
+    return lastLmRate < lastAdamRate;
+}
+
+void LmMonitor::printSummary() const{
+    std::cout << "Levenberg-Marquardt steps accepted: " << accepted << "/" << steps << " in " << totalLmTime << "s. "
+              << "PSNR gained per second on the check cameras: "
+              << (totalLmTime > 0.0 ? totalLmGain / totalLmTime : 0.0) << " dB/s by LM, "
+              << (totalAdamTime > 0.0 ? totalAdamGain / totalAdamTime : 0.0) << " dB/s by Adam" << std::endl;
+}
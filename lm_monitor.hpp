@@ -0,0 +1,55 @@
+#ifndef LM_MONITOR_H
+#define LM_MONITOR_H
+
+#include <cstddef>
+
+// Losses of the camera batch checked by a Levenberg-Marquardt step,
+// before and after the step (the same values when it was rejected)
+struct LmResult{
+    bool accepted = false;
+    float lossBefore = 0.0f; // mean training loss (L1 + SSIM)
+    float lossAfter = 0.0f;
+    float psnrBefore = 0.0f; // mean PSNR
+    float psnrAfter = 0.0f;
+};
+
+// Compares the PSNR gained per second by the Levenberg-Marquardt steps with
+// the one gained by the Adam steps on the same fixed camera batch: Adam's
+// gain is measured between the end of an LM step and the start of the next.
+// Over each window of LM steps, reports whether the time spent in them
+// would have been better spent on more Adam steps
+class LmMonitor{
+public:
+    LmMonitor(int window = 50) : window(window) {};
+
+    // Records one LM step, adamSeconds being the time of the training step
+    // that preceded it. Returns true when a window completed with LM
+    // gaining less PSNR per second than Adam
+    bool update(const LmResult &r, double adamSeconds, double lmSeconds);
+
+    // The batch PSNR changes scale (e.g. with the image resolution)
+    void reset(){ hasPrevious = false; }
+
+    // dB per second over the last completed window
+    double lmRate() const { return lastLmRate; }
+    double adamRate() const { return lastAdamRate; }
+    void printSummary() const;
+private:
+    int window;
+    bool hasPrevious = false;
+    float previousPsnr = 0.0f;
+
+    // Current window
+    int samples = 0;
+    double lmGain = 0.0, lmTime = 0.0;
+    double adamGain = 0.0, adamTime = 0.0;
+    double lastLmRate = 0.0, lastAdamRate = 0.0;
+
+    // Whole run
+    int steps = 0;
+    int accepted = 0;
+    double totalLmGain = 0.0, totalLmTime = 0.0;
+    double totalAdamGain = 0.0, totalAdamTime = 0.0;
+};
+
+#endif
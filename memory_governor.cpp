@@ -0,0 +1,111 @@
+#include "memory_governor.hpp"
+
+#include <fstream>
+#include <limits>
+#include <string>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace{
+
+// Share of the limit at which each action is taken
+const double thresholds[MemoryGovernor::NumActions] = { 0.70, 0.80, 0.85, 0.92 };
+
+size_t readLimitFile(const std::string &path){
+    std::ifstream f(path);
+    std::string value;
+    if (!(f >> value) || value == "max") return 0;
+    try{
+        return static_cast<size_t>(std::stoull(value));
+    }catch(const std::exception &){
+        return 0;
+    }
+}
+
+}
+
+size_t residentMemory(){
+    #ifdef __linux__
+    std::ifstream f("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    if (!(f >> size >> resident)) return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    #else
+    return 0;
+    #endif
+}
+
+size_t peakResidentMemory(){
+    #ifdef __linux__
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line)){
+        if (line.rfind("VmHWM:", 0) == 0) return static_cast<size_t>(std::stoull(line.substr(6))) * 1024;
+    }
+    #endif
+    return 0;
+}
+
+size_t memoryLimit(){
+    #ifdef __linux__
+    const size_t physical = static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    // cgroup v2, then v1 (which reports a huge number when unlimited)
+    size_t limit = readLimitFile("/sys/fs/cgroup/memory.max");
+    if (limit == 0) limit = readLimitFile("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+    if (limit == 0 || limit > physical) limit = physical;
+    return limit;
+    #else
+    return 0;
+    #endif
+}
+
+std::vector<MemoryGovernor::Action> MemoryGovernor::update(int step){
+    std::vector<Action> actions;
+    if (limitBytes == 0 || step % checkEvery != 0) return actions;
+
+    const size_t previous = lastResident;
+    lastResident = residentMemory();
+    checks++;
+    const double share = static_cast<double>(lastResident) / static_cast<double>(limitBytes);
+
+    if (checks > 1){
+        const double growth = static_cast<double>(lastResident) - static_cast<double>(previous);
+        growthRate = checks == 2 ? growth : growthRate + 0.3 * (growth - growthRate);
+    }
+
+    // Checks left before pausing at the current growth rate, with hysteresis
+    const double headroom = thresholds[PauseSplitting] * static_cast<double>(limitBytes) - static_cast<double>(lastResident);
+    const double checksLeft = growthRate > 0.0 ? headroom / growthRate : std::numeric_limits<double>::infinity();
+    if (checksLeft < 8.0) raising = true;
+    else if (checksLeft > 16.0) raising = false;
+
+    for (int a = 0; a < NumActions; a++){
+        if (share < thresholds[a]) break;
+
+        if (a == RaiseGradThresh){
+            if (raising && !taken[PauseSplitting] && raised * RaiseFactor <= MaxRaise &&
+                (lastRaise < 0 || checks - lastRaise >= 2)){
+                actions.push_back(RaiseGradThresh);
+                lastRaise = checks;
+                raised *= RaiseFactor;
+            }
+        }else if (!taken[a]){
+            actions.push_back(static_cast<Action>(a));
+        }
+        taken[a] = true;
+    }
+    return actions;
+}
+
+const char *MemoryGovernor::describe(Action a){
+    switch(a){
+        case EvictPyramids: return "evicting cached image levels";
+        case ShrinkCaches: return "shrinking the rasterizer and SSIM caches";
+        case RaiseGradThresh: return "raising the densification gradient threshold";
+        case PauseSplitting: return "pausing densification";
+        default: return "";
+    }
+}
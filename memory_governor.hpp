@@ -0,0 +1,54 @@
+#ifndef MEMORY_GOVERNOR_H
+#define MEMORY_GOVERNOR_H
+
+#include <cstddef>
+#include <vector>
+
+// Resident memory of this process in bytes (0 if unknown)
+size_t residentMemory();
+
+// Largest resident memory of this process so far in bytes (0 if unknown)
+size_t peakResidentMemory();
+
+// Memory limit of the cgroup of this process, or the physical memory
+// if it has none (0 if unknown)
+size_t memoryLimit();
+
+// Watches the resident memory of the process against a limit and tells
+// which actions to take as it gets closer, from the cheapest to the one
+// that hurts quality the most
+class MemoryGovernor{
+public:
+    enum Action{ EvictPyramids = 0, ShrinkCaches, RaiseGradThresh, PauseSplitting, NumActions };
+
+    // Factor of each raise of the gradient threshold, and bound of their product
+    static constexpr float RaiseFactor = 1.25f;
+    static constexpr float MaxRaise = 4.0f;
+
+    MemoryGovernor(size_t limit, int checkEvery = 25) : limitBytes(limit), checkEvery(checkEvery) {};
+
+    // Actions to take at step, in order of severity. Each is returned once,
+    // the first time its share of the limit is reached, except RaiseGradThresh.
+    // Above its share, that one is returned every other check while memory
+    // grows fast enough to reach the share of PauseSplitting within 8 checks,
+    // until growth slows down to 16 checks or more, and at most until the
+    // threshold was raised by MaxRaise
+    std::vector<Action> update(int step);
+
+    static const char *describe(Action a);
+
+    size_t limit() const { return limitBytes; }
+    size_t resident() const { return lastResident; }
+private:
+    size_t limitBytes;
+    int checkEvery;
+    size_t lastResident = 0;
+    int checks = 0;
+    int lastRaise = -1;
+    double growthRate = 0.0; // bytes per check, smoothed
+    bool raising = false;
+    float raised = 1.0f;
+    bool taken[NumActions] = { false, false, false, false };
+};
+
+#endif
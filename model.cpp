@@ -5,6 +5,7 @@
 #include "rasterize_gaussians.hpp"
 #include "tensor_math.hpp"
 #include "gsplat.hpp"
+#include "task_scheduler.hpp"
 
 #ifdef USE_HIP
 #include <c10/hip/HIPCachingAllocator.h>
@@ -24,20 +25,6 @@ torch::Tensor randomQuatTensor(long long n){
     }, -1);
 }
 
-torch::Tensor projectionMatrix(float zNear, float zFar, float fovX, float fovY, const torch::Device &device){
-    // OpenGL perspective projection matrix
-    float t = zNear * std::tan(0.5f * fovY);
-    float b = -t;
-    float r = zNear * std::tan(0.5f * fovX);
-    float l = -r;
-    return torch::tensor({
-        {2.0f * zNear / (r - l), 0.0f, (r + l) / (r - l), 0.0f},
-        {0.0f, 2 * zNear / (t - b), (t + b) / (t - b), 0.0f},
-        {0.0f, 0.0f, (zFar + zNear) / (zFar - zNear), -1.0f * zFar * zNear / (zFar - zNear)},
-        {0.0f, 0.0f, 1.0f, 0.0f}
-    }, device);
-}
-
 torch::Tensor psnr(const torch::Tensor& rendered, const torch::Tensor& gt){
     torch::Tensor mse = (rendered - gt).pow(2).mean();
     return (10.f * torch::log10(1.0 / mse));
@@ -47,39 +34,56 @@ torch::Tensor l1(const torch::Tensor& rendered, const torch::Tensor& gt){
     return torch::abs(gt - rendered).mean();
 }
 
-torch::Tensor Model::forward(Camera& cam, int step){
+torch::Tensor footprintAreas(const torch::Tensor &conics, const torch::Tensor &radii, int height, int width){
+    torch::Tensor det = torch::clamp_min(conics.index({Slice(), 0}) * conics.index({Slice(), 2}) - conics.index({Slice(), 1}).pow(2), 1e-12f);
+    torch::Tensor area = torch::clamp_max(9.0f * PI / torch::sqrt(det), static_cast<float>(height * width));
+    return area * (radii > 0).to(area.scalar_type());
+}
 
-    const float scaleFactor = getDownscaleFactor(step);
-    const float fx = cam.fx / scaleFactor;
-    const float fy = cam.fy / scaleFactor;
-    const float cx = cam.cx / scaleFactor;
-    const float cy = cam.cy / scaleFactor;
-    const int height = static_cast<int>(static_cast<float>(cam.height) / scaleFactor);
-    const int width = static_cast<int>(static_cast<float>(cam.width) / scaleFactor);
+torch::Tensor seenByCameras(const torch::Tensor &points, const std::vector<Camera> &cameras){
+    torch::NoGradGuard noGrad;
+    torch::Tensor p = points.cpu();
+    torch::Tensor seen = torch::zeros({p.size(0)}, torch::kBool);
+
+    for (const Camera &cam : cameras){
+        CameraConstants c = CameraBank::compute(cam, 1, torch::kCPU);
+        torch::Tensor pc = torch::matmul(p, c.viewMat.index({Slice(None, 3), Slice(None, 3)}).transpose(0, 1)) +
+                           c.viewMat.index({Slice(None, 3), 3});
+        torch::Tensor z = pc.index({Slice(), 2});
+        torch::Tensor u = c.fx * pc.index({Slice(), 0}) / z + c.cx;
+        torch::Tensor v = c.fy * pc.index({Slice(), 1}) / z + c.cy;
+        seen |= (z > 0.01f) & (u >= 0.0f) & (u < c.width) & (v >= 0.0f) & (v < c.height);
+    }
+    return seen;
+}
 
-    // TODO: these can be moved to Camera and computed only once?
-    torch::Tensor R = cam.camToWorld.index({Slice(None, 3), Slice(None, 3)});
-    torch::Tensor T = cam.camToWorld.index({Slice(None, 3), Slice(3,4)});
+torch::Tensor insideBox(const torch::Tensor &points, const torch::Tensor &boxMin, const torch::Tensor &boxMax){
+    return ((points >= boxMin.to(points.device())) & (points <= boxMax.to(points.device()))).all(-1);
+}
 
-    // Flip the z and y axes to align with gsplat conventions
-    R = torch::matmul(R, torch::diag(torch::tensor({1.0f, -1.0f, -1.0f}, R.device())));
+torch::Tensor Model::forward(Camera& cam, int step){
 
-    // worldToCam
-    torch::Tensor Rinv = R.transpose(0, 1);
-    torch::Tensor Tinv = torch::matmul(-Rinv, T);
+    const int scaleFactor = getDownscaleFactor(step);
+    CameraConstants missed;
+    const CameraConstants *cc = cameraBank.find(cam, scaleFactor);
+    if (cc == nullptr){
+        missed = CameraBank::compute(cam, scaleFactor, device);
+        cc = &missed;
+    }
+    const float fx = cc->fx;
+    const float fy = cc->fy;
+    const float cx = cc->cx;
+    const float cy = cc->cy;
+    const int height = cc->height;
+    const int width = cc->width;
+    const torch::Tensor &viewMat = cc->viewMat;
+    const torch::Tensor &projMat = cc->projMat;
 
     lastHeight = height;
     lastWidth = width;
 
-    torch::Tensor viewMat = torch::eye(4, device);
-    viewMat.index_put_({Slice(None, 3), Slice(None, 3)}, Rinv);
-    viewMat.index_put_({Slice(None, 3), Slice(3, 4)}, Tinv);
-        
-    float fovX = 2.0f * std::atan(width / (2.0f * fx));
-    float fovY = 2.0f * std::atan(height / (2.0f * fy));
-
-    torch::Tensor projMat = projectionMatrix(0.001f, 1000.0f, fovX, fovY, device);
-    torch::Tensor colors =  torch::cat({featuresDc.index({Slice(), None, Slice()}), featuresRest}, 1);
+    int degreesToUse = getShDegree(step);
+    if (degreesToUse > shAllocated) growShCoefficients(degreesToUse);
 
     torch::Tensor conics;
     torch::Tensor depths; // GPU-only
@@ -94,7 +98,7 @@ torch::Tensor Model::forward(Camera& cam, int step){
                                 1, 
                                 quats / quats.norm(2, {-1}, true), 
                                 viewMat, 
-                                torch::matmul(projMat, viewMat),
+                                projMat,
                                 fx, 
                                 fy,
                                 cx,
@@ -117,7 +121,7 @@ torch::Tensor Model::forward(Camera& cam, int step){
                         1, 
                         quats / quats.norm(2, {-1}, true), 
                         viewMat, 
-                        torch::matmul(projMat, viewMat),
+                        projMat,
                         fx, 
                         fy,
                         cx,
@@ -135,51 +139,113 @@ torch::Tensor Model::forward(Camera& cam, int step){
             throw std::runtime_error("GPU support not built, use --cpu");
         #endif
     }
+
+    // Frozen gaussians in view are rasterized after the trainable ones
+    torch::Tensor allXys = xys, allRadii = radii, allConics = conics, allCov2d = cov2d, allCamDepths = camDepths;
+    torch::Tensor allDepths = depths, allNumTilesHit = numTilesHit;
+    FrozenView fv;
+    if (numFrozen() > 0){
+        fv = frozenView(cam, *cc, scaleFactor);
+        const std::vector<torch::Tensor> &f = fv.proj;
+
+        if (device == torch::kCPU){
+            allXys = torch::cat({xys, f[0]}, 0);
+            allRadii = torch::cat({radii, f[1]}, 0);
+            allConics = torch::cat({conics, f[2]}, 0);
+            allCov2d = torch::cat({cov2d, f[3]}, 0);
+            allCamDepths = torch::cat({camDepths, f[4]}, 0);
+        }else{
+            allXys = torch::cat({xys, f[0]}, 0);
+            allDepths = torch::cat({depths, f[1]}, 0);
+            allRadii = torch::cat({radii, f[2]}, 0);
+            allConics = torch::cat({conics, f[3]}, 0);
+            allNumTilesHit = torch::cat({numTilesHit, f[4]}, 0);
+        }
+    }
     
 
-    if (radii.sum().item<float>() == 0.0f)
-        return backgroundColor.repeat({height, width, 1});
+    {
+        // Only part of the graph when footprintLoss() is used
+        torch::AutoGradMode gradMode(footprintWeight > 0.0f && torch::GradMode::is_enabled());
+        coverage = (torch::sigmoid(opacities).index({Slice(), 0}) * footprintAreas(conics, radii, height, width)).sum() / static_cast<float>(height * width);
+    }
 
-    // TODO: is this needed?
-    xys.retain_grad();
+    if (allRadii.sum().item<float>() == 0.0f){
+        torch::Tensor bg = backgroundColor.repeat({height, width, 1});
+        return tileMajor ? image_to_tile_major(bg) : bg;
+    }
+
+    // The CPU rasterizer computes the densification statistics in its backward pass
+    if (device != torch::kCPU) xys.retain_grad();
 
-    torch::Tensor viewDirs = means.detach() - T.transpose(0, 1).to(device);
+    torch::Tensor viewDirs = means.detach() - cc->center;
     viewDirs = viewDirs / viewDirs.norm(2, {-1}, true);
-    int degreesToUse = (std::min<int>)(step / shDegreeInterval, shDegree);
     torch::Tensor rgbs;
     
     if (device == torch::kCPU){
-        rgbs = SphericalHarmonicsCPU::apply(degreesToUse, viewDirs, colors);
+        rgbs = SphericalHarmonicsCPU::apply(degreesToUse, viewDirs, featuresDc, featuresRest);
     }else{
         #if defined(USE_HIP) || defined(USE_CUDA)
+        torch::Tensor colors = torch::cat({featuresDc.index({Slice(), None, Slice()}), featuresRest.to(torch::kFloat32)}, 1);
         rgbs = SphericalHarmonics::apply(degreesToUse, viewDirs, colors);
         #endif
     }
     
     rgbs = torch::clamp_min(rgbs + 0.5f, 0.0f);
 
+    torch::Tensor opac = torch::sigmoid(opacities);
+    if (numFrozen() > 0){
+        rgbs = torch::cat({rgbs, fv.rgbs}, 0);
+        opac = torch::cat({opac, fv.opacities}, 0);
+    }
+
     if (device == torch::kCPU){
+        DensificationStats *stats = nullptr;
+        if (step < stopSplitAt){
+            initDensificationStats();
+            densifyStats.radii = radii;
+            stats = &densifyStats;
+        }
+
+        // Cache the blended alphas when the arena, estimated from the pairs
+        // blended by the previous render, fits in the budget. The first
+        // render only counts its pairs
+        AlphaStack *stack = nullptr;
+        if (alphaStackBudget > 0){
+            const size_t pixels = static_cast<size_t>(height) * width;
+            const double pairs = alphaStackPixels > 0 ? static_cast<double>(alphaStack.numEntries) * pixels / alphaStackPixels : 0.0;
+            alphaStack.record = alphaStackPixels > 0 && alphaStack.bytes(static_cast<size_t>(pairs), pixels) <= alphaStackBudget;
+            alphaStackPixels = pixels;
+            stack = &alphaStack;
+        }
+
         rgb = RasterizeGaussiansCPU::apply(
-                xys,
-                radii,
-                conics,
+                allXys,
+                allRadii,
+                allConics,
                 rgbs,
-                torch::sigmoid(opacities),
-                cov2d,
-                camDepths,
+                opac,
+                allCov2d,
+                allCamDepths,
                 height,
                 width,
-                backgroundColor);
+                backgroundColor,
+                stats,
+                tileMajor,
+                stack,
+                depthOrderHint(cam),
+                backwardSkip,
+                skipSeed(cam, step));
     }else{  
         #if defined(USE_HIP) || defined(USE_CUDA)
         rgb = RasterizeGaussians::apply(
-                xys,
-                depths,
-                radii,
-                conics,
-                numTilesHit,
+                allXys,
+                allDepths,
+                allRadii,
+                allConics,
+                allNumTilesHit,
                 rgbs,
-                torch::sigmoid(opacities),
+                opac,
                 height,
                 width,
                 backgroundColor);
@@ -191,6 +257,118 @@ torch::Tensor Model::forward(Camera& cam, int step){
     return rgb;
 }
 
+size_t Model::shrinkCaches(){
+    size_t bytes = alphaStack.capacityBytes();
+    alphaStack = AlphaStack();
+    alphaStackPixels = 0;
+    alphaStackBudget /= 2;
+
+    for (const auto &kv : depthOrders) bytes += kv.second.capacity() * sizeof(int32_t);
+    depthOrders.clear();
+    depthOrderBudget /= 2;
+
+    bytes += ssimMomentsBytes;
+    ssimMoments.clear();
+    ssimMomentsBytes = 0;
+    ssimCacheBudget /= 2;
+
+    bytes += frozenViewsBytes;
+    frozenViews.clear();
+    frozenViewsBytes = 0;
+    frozenCacheBudget /= 2;
+
+    return bytes;
+}
+
+const SsimMoments *Model::gtMoments(const torch::Tensor &gt, const Camera &cam, int downscaleFactor){
+    if (ssimCacheBudget == 0) return nullptr;
+
+    // Images of other downscale factors are not used again
+    if (downscaleFactor != ssimMomentsLevel){
+        ssimMoments.clear();
+        ssimMomentsBytes = 0;
+        ssimMomentsLevel = downscaleFactor;
+    }
+
+    auto it = ssimMoments.find(cam.idx);
+    if (it != ssimMoments.end()) return &it->second;
+
+    int height, width;
+    CameraBank::imageSize(cam, downscaleFactor, height, width);
+    uncachedMoments = ssim.moments(tileMajor ? tile_major_to_image(gt, height, width) : gt);
+    // The planar image is a view of gt unless it was untiled
+    const size_t bytes = uncachedMoments.bytes() + (tileMajor ? uncachedMoments.image.nbytes() : 0);
+    if (ssimMomentsBytes + bytes > ssimCacheBudget) return &uncachedMoments;
+    ssimMomentsBytes += bytes;
+    return &(ssimMoments[cam.idx] = std::move(uncachedMoments));
+}
+
+Model::FrozenView Model::frozenView(const Camera &cam, const CameraConstants &cc, int scaleFactor){
+    // Views of other downscale factors are not used again
+    if (scaleFactor != frozenViewsLevel){
+        frozenViews.clear();
+        frozenViewsBytes = 0;
+        frozenViewsLevel = scaleFactor;
+    }
+
+    auto it = frozenViews.find(cam.idx);
+    if (it != frozenViews.end()) return it->second;
+
+    torch::NoGradGuard noGrad;
+    FrozenView v;
+    int radiiIdx;
+    if (device == torch::kCPU){
+        v.proj = ProjectGaussiansCPU::apply(frozen.means, frozen.scales, 1, frozen.quats, cc.viewMat, cc.projMat,
+                                            cc.fx, cc.fy, cc.cx, cc.cy, cc.height, cc.width);
+        radiiIdx = 1;
+    }else{
+        #if defined(USE_HIP) || defined(USE_CUDA)
+        TileBounds tileBounds = std::make_tuple((cc.width + BLOCK_X - 1) / BLOCK_X,
+                        (cc.height + BLOCK_Y - 1) / BLOCK_Y,
+                        1);
+        v.proj = ProjectGaussians::apply(frozen.means, frozen.scales, 1, frozen.quats, cc.viewMat, cc.projMat,
+                                         cc.fx, cc.fy, cc.cx, cc.cy, cc.height, cc.width, tileBounds);
+        radiiIdx = 2;
+        #else
+            throw std::runtime_error("GPU support not built, use --cpu");
+        #endif
+    }
+
+    // Gaussians out of view are dropped
+    torch::Tensor visible = torch::where(v.proj[radiiIdx].flatten() > 0)[0];
+    for (torch::Tensor &t : v.proj) t = t.index_select(0, visible);
+
+    torch::Tensor dirs = frozen.means.index_select(0, visible) - cc.center;
+    dirs = dirs / dirs.norm(2, {-1}, true);
+    torch::Tensor shs = frozen.shs.index_select(0, visible);
+    if (device == torch::kCPU){
+        v.rgbs = SphericalHarmonicsCPU::apply(frozen.shDegree, dirs, shs);
+    }else{
+        #if defined(USE_HIP) || defined(USE_CUDA)
+        v.rgbs = SphericalHarmonics::apply(frozen.shDegree, dirs, shs);
+        #endif
+    }
+    v.rgbs = torch::clamp_min(v.rgbs + 0.5f, 0.0f);
+    v.opacities = frozen.opacities.index_select(0, visible);
+
+    size_t bytes = v.rgbs.nbytes() + v.opacities.nbytes();
+    for (const torch::Tensor &t : v.proj) bytes += t.nbytes();
+    if (frozenViewsBytes + bytes > frozenCacheBudget) return v;
+    frozenViewsBytes += bytes;
+    return frozenViews[cam.idx] = v;
+}
+
+std::vector<int32_t> *Model::depthOrderHint(const Camera &cam){
+    if (depthOrderBudget == 0) return nullptr;
+
+    auto it = depthOrders.find(cam.idx);
+    if (it != depthOrders.end()) return &it->second;
+
+    const size_t bytes = (depthOrders.size() + 1) * static_cast<size_t>(means.size(0) + numFrozen()) * sizeof(int32_t);
+    if (bytes > depthOrderBudget) return nullptr;
+    return &depthOrders[cam.idx];
+}
+
 void Model::optimizersZeroGrad(){
   meansOpt->zero_grad();
   scalesOpt->zero_grad();
@@ -205,18 +383,207 @@ void Model::optimizersStep(){
     quatsOpt->step();
     scalesOpt->step();
     featuresDcOpt->step();
-    featuresRestOpt->step();
+    if (featuresRest.scalar_type() == torch::kFloat32) featuresRestOpt->step();
+    else stepHalfRest();
     opacitiesOpt->step();
 }
 
+void Model::stepHalfRest(){
+    torch::NoGradGuard noGrad;
+    torch::Tensor grad = featuresRest.grad();
+    if (!grad.defined()) return;
+
+#if TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR > 1
+    auto pId = featuresRest.unsafeGetTensorImpl();
+#else
+    auto pId = c10::guts::to_string(featuresRest.unsafeGetTensorImpl());
+#endif
+    auto &states = featuresRestOpt->state();
+    if (states.find(pId) == states.end()){
+        auto state = std::make_unique<torch::optim::AdamParamState>();
+        state->step(0);
+        state->exp_avg(torch::zeros(featuresRest.sizes(), featuresRest.options().dtype(torch::kFloat32)));
+        state->exp_avg_sq(torch::zeros(featuresRest.sizes(), featuresRest.options().dtype(torch::kFloat32)));
+        states[pId] = std::move(state);
+    }
+    auto &state = static_cast<torch::optim::AdamParamState&>(*states[pId]);
+    const auto &opts = static_cast<const torch::optim::AdamOptions&>(featuresRestOpt->param_groups()[0].options());
+
+    state.step(state.step() + 1);
+    const double beta1 = std::get<0>(opts.betas());
+    const double beta2 = std::get<1>(opts.betas());
+    const double biasCorrection1 = 1.0 - std::pow(beta1, static_cast<double>(state.step()));
+    const double biasCorrection2 = 1.0 - std::pow(beta2, static_cast<double>(state.step()));
+    const double stepSize = opts.lr() / biasCorrection1;
+
+    // Significant bits and smallest normal value of the storage type. Below
+    // it, the unit in the last place is that of the smallest normal value
+    const bool bf16 = featuresRest.scalar_type() == torch::kBFloat16;
+    const int precision = bf16 ? 8 : 11;
+    const float minNormal = std::ldexp(1.0f, bf16 ? -126 : -14);
+
+    // The update is computed in fp32 a chunk of gaussians at a time, and
+    // rounded stochastically: adding up to half a unit in the last place
+    // before rounding to nearest keeps small updates unbiased in expectation
+    const long long numPoints = featuresRest.size(0);
+    const long long chunk = 16384;
+    for (long long start = 0; start < numPoints; start += chunk){
+        const long long end = (std::min)(start + chunk, numPoints);
+        torch::Tensor param = featuresRest.slice(0, start, end);
+        torch::Tensor g = grad.slice(0, start, end).to(torch::kFloat32);
+        torch::Tensor m = state.exp_avg().slice(0, start, end);
+        torch::Tensor v = state.exp_avg_sq().slice(0, start, end);
+
+        m.mul_(beta1).add_(g, 1.0 - beta1);
+        v.mul_(beta2).addcmul_(g, g, 1.0 - beta2);
+        torch::Tensor x = param.to(torch::kFloat32);
+        x.addcdiv_(m, (v / biasCorrection2).sqrt_().add_(opts.eps()), -stepSize);
+
+        torch::Tensor exponent = std::get<1>(torch::frexp(x.abs().clamp_min(minNormal)));
+        torch::Tensor ulp = torch::exp2((exponent - precision).to(torch::kFloat32));
+        x.add_((torch::rand_like(x) - 0.5f) * ulp);
+        param.copy_(x);
+    }
+}
+
+size_t Model::shRestBytes(){
+    size_t bytes = featuresRest.nbytes();
+    if (featuresRest.grad().defined()) bytes += featuresRest.grad().nbytes();
+#if TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR > 1
+    auto pId = featuresRest.unsafeGetTensorImpl();
+#else
+    auto pId = c10::guts::to_string(featuresRest.unsafeGetTensorImpl());
+#endif
+    auto it = featuresRestOpt->state().find(pId);
+    if (it != featuresRestOpt->state().end()){
+        auto &state = static_cast<torch::optim::AdamParamState&>(*it->second);
+        bytes += state.exp_avg().nbytes() + state.exp_avg_sq().nbytes();
+    }
+    return bytes;
+}
+
 void Model::schedulersStep(int step){
   meansOptScheduler->step(step);
 }
 
 int Model::getDownscaleFactor(int step){
+    if (adaptiveSchedule != nullptr) return adaptiveSchedule->downscaleFactor();
     return std::pow(2, (std::max<int>)(numDownscales - step / resolutionSchedule, 0));
 }
 
+int Model::getShDegree(int step){
+    if (adaptiveSchedule != nullptr) return (std::max<int>)(adaptiveSchedule->shDegree(), shStart);
+    return (std::min<int>)((std::max<int>)(step / shDegreeInterval, shStart), shDegree);
+}
+
+void Model::growShCoefficients(int degree){
+    torch::NoGradGuard noGrad;
+
+    torch::Tensor &rest = featuresRest;
+    const long long numPoints = rest.size(0);
+    const long long numNew = numShBases(degree) - 1 - rest.size(1);
+    auto pad = [&](const torch::Tensor &t){
+        return torch::cat({t, torch::zeros({numPoints, numNew, 3}, t.options())}, 1);
+    };
+
+    // The optimizer state only exists after the first step
+    torch::Tensor param = featuresRestOpt->param_groups()[0].params()[0];
+#if TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR > 1
+    auto pId = param.unsafeGetTensorImpl();
+#else
+    auto pId = c10::guts::to_string(param.unsafeGetTensorImpl());
+#endif
+    std::unique_ptr<torch::optim::AdamParamState> paramState;
+    if (featuresRestOpt->state().find(pId) != featuresRestOpt->state().end()){
+        paramState = std::make_unique<torch::optim::AdamParamState>(static_cast<torch::optim::AdamParamState&>(*featuresRestOpt->state()[pId]));
+        paramState->exp_avg(pad(paramState->exp_avg()));
+        paramState->exp_avg_sq(pad(paramState->exp_avg_sq()));
+        featuresRestOpt->state().erase(pId);
+    }
+
+    rest = pad(rest.detach()).requires_grad_();
+
+#if TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR > 1
+    auto newPId = rest.unsafeGetTensorImpl();
+#else
+    auto newPId = c10::guts::to_string(rest.unsafeGetTensorImpl());
+#endif
+    if (paramState) featuresRestOpt->state()[newPId] = std::move(paramState);
+    featuresRestOpt->param_groups()[0].params()[0] = rest;
+
+    shAllocated = degree;
+}
+
+void Model::resume(const GaussianSnapshot &s, const torch::Tensor &region, const torch::Tensor &keepPoints){
+    torch::NoGradGuard noGrad;
+    if (hasMeshConstraint) throw std::runtime_error("Cannot resume a model with a mesh constraint");
+
+    torch::Tensor r = region.cpu();
+    torch::Tensor keep = keepPoints.to(device);
+    const int degree = (std::min)(s.shDegree, shDegree);
+    const long long numRest = numShBases(degree) - 1;
+    const long long numKept = keep.sum().item<long long>();
+
+    torch::Tensor shs = s.shs.index({r});
+    torch::Tensor rest = torch::cat({
+        shs.index({Slice(), Slice(1, numRest + 1), Slice()}).to(device, featuresRest.scalar_type()),
+        torch::zeros({numKept, numRest, 3}, featuresRest.options())
+    }, 0);
+
+    means = torch::cat({s.means.index({r}).to(device), means.detach().index({keep})}, 0).requires_grad_();
+    scales = torch::cat({torch::log(s.scales.index({r})).to(device), scales.detach().index({keep})}, 0).requires_grad_();
+    quats = torch::cat({s.quats.index({r}).to(device), quats.detach().index({keep})}, 0).requires_grad_();
+    featuresDc = torch::cat({shs.index({Slice(), 0, Slice()}).to(device), featuresDc.detach().index({keep})}, 0).requires_grad_();
+    featuresRest = rest.requires_grad_();
+    opacities = torch::cat({torch::logit(s.opacities.index({r}), 1e-6).to(device), opacities.detach().index({keep})}, 0).requires_grad_();
+    shAllocated = degree;
+    shStart = degree;
+    depthOrders.clear();
+
+    // Nothing is in the optimizers' state before the first step
+    meansOpt->param_groups()[0].params()[0] = means;
+    scalesOpt->param_groups()[0].params()[0] = scales;
+    quatsOpt->param_groups()[0].params()[0] = quats;
+    featuresDcOpt->param_groups()[0].params()[0] = featuresDc;
+    featuresRestOpt->param_groups()[0].params()[0] = featuresRest;
+    opacitiesOpt->param_groups()[0].params()[0] = opacities;
+
+    torch::Tensor f = ~r;
+    frozen.means = s.means.index({f}).to(device).contiguous();
+    frozen.scales = s.scales.index({f}).to(device).contiguous();
+    frozen.quats = s.quats.index({f}).to(device).contiguous();
+    frozen.shs = s.shs.index({f}).to(device).contiguous();
+    frozen.opacities = s.opacities.index({f}).to(device).contiguous();
+    frozen.shDegree = s.shDegree;
+    frozen.degreesToUse = s.shDegree;
+
+    std::cout << "Resuming " << s.means.size(0) << " gaussians: " << r.sum().item<long long>() << " in the region (plus "
+              << numKept << " new points), " << numFrozen() << " frozen" << std::endl;
+}
+
+void Model::enableAdaptiveSchedule(int window, float plateauThresh){
+    delete adaptiveSchedule;
+    adaptiveSchedule = new AdaptiveSchedule(numDownscales, shDegree, resolutionSchedule, shDegreeInterval, window, plateauThresh);
+}
+
+void Model::observeLoss(int step, float loss){
+    if (adaptiveSchedule != nullptr) adaptiveSchedule->update(step, loss);
+}
+
+void Model::setScheduleScale(float s){
+    auto scaled = [s](int steps, int minSteps){
+        return (std::max)(static_cast<int>(std::lround(steps * static_cast<double>(s))), minSteps);
+    };
+    resolutionSchedule = scaled(baseSchedule.resolutionSchedule, 1);
+    shDegreeInterval = scaled(baseSchedule.shDegreeInterval, 1);
+    refineEvery = scaled(baseSchedule.refineEvery, 1);
+    warmupLength = scaled(baseSchedule.warmupLength, 0);
+    stopSplitAt = scaled(baseSchedule.stopSplitAt, 0);
+    stopScreenSizeAt = scaled(baseSchedule.stopScreenSizeAt, 0);
+    maxSteps = scaled(baseSchedule.maxSteps, 1);
+    meansOptScheduler->setMaxSteps(maxSteps);
+}
+
 void Model::addToOptimizer(torch::optim::Adam *optimizer, const torch::Tensor &newParam, const torch::Tensor &idcs, int nSamples){
     torch::Tensor param = optimizer->param_groups()[0].params()[0];
 #if TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR > 1
@@ -278,21 +645,14 @@ void Model::removeFromOptimizer(torch::optim::Adam *optimizer, const torch::Tens
 void Model::afterTrain(int step){
     torch::NoGradGuard noGrad;
 
-    if (step < stopSplitAt){
+    if (step < stopSplitAt && device != torch::kCPU){
+        initDensificationStats();
         torch::Tensor visibleMask = (radii > 0).flatten();
         
         torch::Tensor grads = torch::linalg::vector_norm(xys.grad().detach(), 2, { -1 }, false, torch::kFloat32);
-        if (!xysGradNorm.numel()){
-            xysGradNorm = grads;
-            visCounts = torch::ones_like(xysGradNorm);
-        }else{
-            visCounts.index_put_({visibleMask}, visCounts.index({visibleMask}) + 1);
-            xysGradNorm.index_put_({visibleMask}, grads.index({visibleMask}) + xysGradNorm.index({visibleMask}));
-        }
-
-        if (!max2DSize.numel()){
-            max2DSize = torch::zeros_like(radii, torch::kFloat32);
-        }
+        if (!densifyStats.firstStep) visCounts.index_put_({visibleMask}, visCounts.index({visibleMask}) + 1);
+        densifyStats.firstStep = false;
+        xysGradNorm.index_put_({visibleMask}, grads.index({visibleMask}) + xysGradNorm.index({visibleMask}));
 
         torch::Tensor newRadii = radii.detach().index({visibleMask});
         max2DSize.index_put_({visibleMask}, torch::maximum(
@@ -306,11 +666,23 @@ void Model::afterTrain(int step){
         torch::Tensor splitsMask;
         const float cullAlphaThresh = 0.1f;
 
-        if (doDensification){
+        if (doDensification && !growthPaused && (maxGaussians <= 0 || means.size(0) < maxGaussians)){
             int numPointsBefore = means.size(0);
+            initDensificationStats();
             torch::Tensor avgGradNorm = (xysGradNorm / visCounts) * 0.5f * static_cast<float>( (std::max)(lastWidth, lastHeight) );
             torch::Tensor highGrads = (avgGradNorm > densifyGradThresh).squeeze();
 
+            // Under maxGaussians, only the highest gradients that fit are densified.
+            // Splits and duplications add one gaussian each, once the split ones are culled
+            if (maxGaussians > 0){
+                const long long room = maxGaussians - means.size(0);
+                if (highGrads.sum().item<long long>() > room){
+                    torch::Tensor top = std::get<1>(torch::topk(avgGradNorm.flatten(), room));
+                    highGrads = torch::zeros_like(highGrads);
+                    highGrads.index_put_({top}, true);
+                }
+            }
+
             // Split gaussians that are too large
             torch::Tensor splits = (std::get<0>(scales.exp().max(-1)) > densifySizeThresh).squeeze();
             if (step < stopScreenSizeAt){
@@ -384,6 +756,7 @@ void Model::afterTrain(int step){
             }, 0);
 
             std::cout << "Added " << (means.size(0) - numPointsBefore) << " gaussians, new count " << means.size(0) << std::endl;
+            depthOrders.clear();
         }
 
         if (doDensification || step >= stopSplitAt){
@@ -407,6 +780,7 @@ void Model::afterTrain(int step){
 
             int cullCount = torch::sum(culls).item<int>();
             if (cullCount > 0){
+                depthOrders.clear();
                 means = means.index({~culls}).detach().requires_grad_();
                 scales = scales.index({~culls}).detach().requires_grad_();
                 quats = quats.index({~culls}).detach().requires_grad_();
@@ -457,69 +831,156 @@ void Model::afterTrain(int step){
     }
 }
 
-void Model::savePlySplat(const std::string &filename){
-    std::ofstream o(filename, std::ios::binary);
-    int numPoints = means.size(0);
+void Model::initDensificationStats(){
+    long long numPoints = means.size(0);
+    if (xysGradNorm.defined() && xysGradNorm.size(0) == numPoints) return;
+
+    torch::TensorOptions opts = torch::TensorOptions().dtype(torch::kFloat32).device(device);
+    // As in the reference implementation, the first step seeds the
+    // statistics of all gaussians: every count starts at one
+    xysGradNorm = torch::zeros({numPoints}, opts);
+    visCounts = torch::ones({numPoints}, opts);
+    max2DSize = torch::zeros({numPoints}, opts);
+    densifyStats.gradNorm = xysGradNorm;
+    densifyStats.visCounts = visCounts;
+    densifyStats.max2DSize = max2DSize;
+    densifyStats.firstStep = true;
+}
 
-    o << "ply" << std::endl;
-    o << "format binary_little_endian 1.0" << std::endl;
-    o << "comment Generated by opensplat" << std::endl;
-    o << "element vertex " << numPoints << std::endl;
-    o << "property float x" << std::endl;
-    o << "property float y" << std::endl;
-    o << "property float z" << std::endl;
-    o << "property float nx" << std::endl;
-    o << "property float ny" << std::endl;
-    o << "property float nz" << std::endl;
+void Model::savePlySplat(const std::string &filename, bool async){
+    torch::NoGradGuard noGrad;
+    int numPoints = means.size(0) + numFrozen();
+
+    // Match Inria's version, coefficients above the allocated degree are zero
+    const long long numRest = numShBases(shDegree) - 1;
+    auto fitRest = [numRest](torch::Tensor rest){
+        rest = rest.cpu().to(torch::kFloat32);
+        if (rest.size(1) < numRest){
+            rest = torch::cat({rest, torch::zeros({rest.size(0), numRest - rest.size(1), 3})}, 1);
+        }
+        return rest.index({Slice(), Slice(None, numRest), Slice()});
+    };
+    torch::Tensor meansCpu = means.cpu();
+    torch::Tensor featuresDcCpu = featuresDc.cpu();
+    torch::Tensor featuresRestCpu = fitRest(featuresRest);
+    torch::Tensor opacitiesCpu = opacities.cpu();
+    torch::Tensor scalesCpu = scales.cpu();
+    torch::Tensor quatsCpu = quats.cpu();
 
-    for (int i = 0; i < featuresDc.size(1); i++){
-        o << "property float f_dc_" << i << std::endl;
+    // Frozen gaussians go back to the parametrization of the trainable ones
+    if (numFrozen() > 0){
+        meansCpu = torch::cat({meansCpu, frozen.means.cpu()}, 0);
+        featuresDcCpu = torch::cat({featuresDcCpu, frozen.shs.index({Slice(), 0, Slice()}).cpu()}, 0);
+        featuresRestCpu = torch::cat({featuresRestCpu, fitRest(frozen.shs.index({Slice(), Slice(1, None), Slice()}))}, 0);
+        opacitiesCpu = torch::cat({opacitiesCpu, torch::logit(frozen.opacities, 1e-6).cpu()}, 0);
+        scalesCpu = torch::cat({scalesCpu, torch::log(frozen.scales).cpu()}, 0);
+        quatsCpu = torch::cat({quatsCpu, frozen.quats.cpu()}, 0);
     }
 
-    // Match Inria's version
-    torch::Tensor featuresRestCpu = featuresRest.cpu().transpose(1, 2).reshape({numPoints, -1});
-    for (int i = 0; i < featuresRestCpu.size(1); i++){
-        o << "property float f_rest_" << i << std::endl;
+    featuresRestCpu = featuresRestCpu.transpose(1, 2).reshape({numPoints, numRest * 3});
+    meansCpu = (meansCpu / scale) + translation;
+    scalesCpu = scalesCpu - std::log(scale);
+
+    torch::Tensor normalsCpu = 
+        (this->hasMeshConstraint) ?
+        this->meshConstraint.normals.cpu() :
+        torch::zeros({numPoints, 3});
+
+    if (async){
+        // Parameters are updated in place by the optimizers,
+        // take a copy before handing them to the writer
+        featuresRestCpu = featuresRestCpu.clone();
+        featuresDcCpu = featuresDcCpu.clone();
+        opacitiesCpu = opacitiesCpu.clone();
+        quatsCpu = quatsCpu.clone();
     }
 
-    o << "property float opacity" << std::endl;
+    auto write = [=](){
+        std::ofstream o(filename, std::ios::binary);
+
+        o << "ply" << std::endl;
+        o << "format binary_little_endian 1.0" << std::endl;
+        o << "comment Generated by opensplat" << std::endl;
+        o << "element vertex " << numPoints << std::endl;
+        o << "property float x" << std::endl;
+        o << "property float y" << std::endl;
+        o << "property float z" << std::endl;
+        o << "property float nx" << std::endl;
+        o << "property float ny" << std::endl;
+        o << "property float nz" << std::endl;
+
+        for (int i = 0; i < featuresDcCpu.size(1); i++){
+            o << "property float f_dc_" << i << std::endl;
+        }
 
-    o << "property float scale_0" << std::endl;
-    o << "property float scale_1" << std::endl;
-    o << "property float scale_2" << std::endl;
+        for (int i = 0; i < featuresRestCpu.size(1); i++){
+            o << "property float f_rest_" << i << std::endl;
+        }
 
-    o << "property float rot_0" << std::endl;
-    o << "property float rot_1" << std::endl;
-    o << "property float rot_2" << std::endl;
-    o << "property float rot_3" << std::endl;
-    
-    o << "end_header" << std::endl;
+        o << "property float opacity" << std::endl;
 
-    float zeros[] = { 0.0f, 0.0f, 0.0f };
+        o << "property float scale_0" << std::endl;
+        o << "property float scale_1" << std::endl;
+        o << "property float scale_2" << std::endl;
 
-    torch::Tensor meansCpu = (means.cpu() / scale) + translation;
-    torch::Tensor featuresDcCpu = featuresDc.cpu();
-    torch::Tensor opacitiesCpu = opacities.cpu();
-    torch::Tensor scalesCpu = scales.cpu() - std::log(scale);
-    torch::Tensor quatsCpu = quats.cpu();
+        o << "property float rot_0" << std::endl;
+        o << "property float rot_1" << std::endl;
+        o << "property float rot_2" << std::endl;
+        o << "property float rot_3" << std::endl;
+        
+        o << "end_header" << std::endl;
+
+        for (size_t i = 0; i < numPoints; i++) {
+            o.write(reinterpret_cast<const char *>(meansCpu[i].data_ptr()), sizeof(float) * 3);
+            o.write(reinterpret_cast<const char *>(normalsCpu[i].data_ptr()), sizeof(float) * 3);
+            o.write(reinterpret_cast<const char *>(featuresDcCpu[i].data_ptr()), sizeof(float) * featuresDcCpu.size(1));
+            o.write(reinterpret_cast<const char *>(featuresRestCpu[i].data_ptr()), sizeof(float) * featuresRestCpu.size(1));
+            o.write(reinterpret_cast<const char *>(opacitiesCpu[i].data_ptr()), sizeof(float) * 1);
+            o.write(reinterpret_cast<const char *>(scalesCpu[i].data_ptr()), sizeof(float) * 3);
+            o.write(reinterpret_cast<const char *>(quatsCpu[i].data_ptr()), sizeof(float) * 4);
+        }
 
-    torch::Tensor normalsCpu = 
-        (this->hasMeshConstraint) ?
-        this->meshConstraint.normals.cpu() :
-        torch::zeros_like(means).cpu();
+        o.close();
+        std::cout << "Wrote " << filename << std::endl;
+    };
 
-    for (size_t i = 0; i < numPoints; i++) {
-        o.write(reinterpret_cast<const char *>(meansCpu[i].data_ptr()), sizeof(float) * 3);
-        o.write(reinterpret_cast<const char *>(normalsCpu[i].data_ptr()), sizeof(float) * 3);
-        o.write(reinterpret_cast<const char *>(featuresDcCpu[i].data_ptr()), sizeof(float) * featuresDcCpu.size(1));
-        o.write(reinterpret_cast<const char *>(featuresRestCpu[i].data_ptr()), sizeof(float) * featuresRestCpu.size(1));
-        o.write(reinterpret_cast<const char *>(opacitiesCpu[i].data_ptr()), sizeof(float) * 1);
-        o.write(reinterpret_cast<const char *>(scalesCpu[i].data_ptr()), sizeof(float) * 3);
-        o.write(reinterpret_cast<const char *>(quatsCpu[i].data_ptr()), sizeof(float) * 4);
-    }
+    if (async) TaskScheduler::instance().submit(TaskPriority::SnapshotIO, write, &snapshotWrites);
+    else write();
+}
 
-    o.close();
-    std::cout << "Wrote " << filename << std::endl;
+void Model::waitForSnapshots(){
+    TaskScheduler::instance().wait(snapshotWrites);
+}
+
+GaussianSnapshot Model::snapshot(int step){
+    torch::NoGradGuard noGrad;
+
+    // Parameters are updated in place by the optimizers, make sure we own a copy
+    GaussianSnapshot s;
+    s.means = means.detach().cpu().clone();
+    s.scales = torch::exp(scales.detach()).cpu().contiguous();
+    s.quats = (quats.detach() / quats.detach().norm(2, {-1}, true)).cpu().contiguous();
+    s.shs = torch::cat({featuresDc.detach().index({Slice(), None, Slice()}), featuresRest.detach().to(torch::kFloat32)}, 1).cpu().contiguous();
+    s.opacities = torch::sigmoid(opacities.detach()).cpu().contiguous();
+    s.background = backgroundColor.cpu().clone();
+    s.shDegree = shAllocated;
+    s.degreesToUse = (std::min)(getShDegree(step), shAllocated);
+
+    if (numFrozen() > 0){
+        // Both sets get the coefficients of the larger degree
+        const long long numBases = (std::max)(s.shs.size(1), frozen.shs.size(1));
+        auto pad = [numBases](const torch::Tensor &shs){
+            if (shs.size(1) == numBases) return shs;
+            return torch::cat({shs, torch::zeros({shs.size(0), numBases - shs.size(1), 3})}, 1);
+        };
+        s.means = torch::cat({s.means, frozen.means.cpu()}, 0);
+        s.scales = torch::cat({s.scales, frozen.scales.cpu()}, 0);
+        s.quats = torch::cat({s.quats, frozen.quats.cpu()}, 0);
+        s.shs = torch::cat({pad(s.shs), pad(frozen.shs.cpu())}, 0);
+        s.opacities = torch::cat({s.opacities, frozen.opacities.cpu()}, 0);
+        s.shDegree = degFromSh(numBases);
+    }
+    return s;
 }
 
 void Model::saveDebugPly(const std::string &filename){
@@ -551,8 +1012,300 @@ void Model::saveDebugPly(const std::string &filename){
     std::cout << "Wrote " << filename << std::endl;
 }
 
-torch::Tensor Model::mainLoss(torch::Tensor &rgb, torch::Tensor &gt, float ssimWeight){
-    torch::Tensor ssimLoss = 1.0f - ssim.eval(rgb, gt);
+torch::Tensor Model::footprintLoss(){
+    return footprintWeight * torch::relu(coverage - footprintTarget);
+}
+
+torch::Tensor Model::mainLoss(torch::Tensor &rgb, torch::Tensor &gt, const Camera &cam, int downscaleFactor, float ssimWeight){
+    const SsimMoments *moments = gtMoments(gt, cam, downscaleFactor);
+    if (tileMajor){
+        // L1 runs on the tiles directly (the padding is zero in both images),
+        // the SSIM window needs the planar images, the ground truth one comes
+        // with its moments
+        int height, width;
+        CameraBank::imageSize(cam, downscaleFactor, height, width);
+        torch::Tensor planarGt = moments != nullptr ? torch::Tensor() : tile_major_to_image(gt, height, width);
+        torch::Tensor ssimLoss = 1.0f - ssim.eval(tile_major_to_image(rgb, height, width), planarGt, moments);
+        torch::Tensor l1Loss = torch::abs(gt - rgb).sum() / static_cast<float>(height * width * 3);
+        return (1.0f - ssimWeight) * l1Loss + ssimWeight * ssimLoss;
+    }
+
+    torch::Tensor ssimLoss = 1.0f - ssim.eval(rgb, gt, moments);
     torch::Tensor l1Loss = l1(rgb, gt);
     return (1.0f - ssimWeight) * l1Loss + ssimWeight * ssimLoss;
 }
+
+void Model::explicitForward(Camera& cam, int step, ExplicitForward &f){
+    if (device != torch::kCPU) throw std::runtime_error("The explicit training step is only available on CPU");
+
+    torch::NoGradGuard noGrad;
+
+    const int scaleFactor = getDownscaleFactor(step);
+    const CameraConstants *cc = cameraBank.find(cam, scaleFactor);
+    f.camera = cc != nullptr ? *cc : CameraBank::compute(cam, scaleFactor, device);
+    const CameraConstants &c = f.camera;
+
+    f.downscaleFactor = scaleFactor;
+    lastHeight = c.height;
+    lastWidth = c.width;
+
+    const long long numPoints = means.size(0);
+    if (!stepXys.defined() || stepXys.size(0) != numPoints){
+        torch::TensorOptions opts = torch::TensorOptions().dtype(torch::kFloat32).device(device);
+        stepXys = torch::empty({numPoints, 2}, opts);
+        stepRadii = torch::empty({numPoints}, opts.dtype(torch::kInt32));
+        stepConics = torch::empty({numPoints, 3}, opts);
+        stepCov2d = torch::empty({numPoints, 2, 2}, opts);
+        stepCamDepths = torch::empty({numPoints}, opts);
+    }
+
+    f.means = means.detach().contiguous();
+    f.scalesExp = torch::exp(scales.detach());
+    f.quatsNorm = quats.detach().norm(2, {-1}, true);
+    f.quatsUnit = quats.detach() / f.quatsNorm;
+
+    project_gaussians_forward_fused_cpu(numPoints, f.means, f.scalesExp, 1.0f, f.quatsUnit,
+                                        c.viewMat, c.projMat, c.fx, c.fy, c.cx, c.cy, c.height, c.width,
+                                        stepXys, stepRadii, stepConics, stepCov2d, stepCamDepths);
+
+    f.viewDirs = means.detach() - c.center;
+    f.viewDirs = f.viewDirs / f.viewDirs.norm(2, {-1}, true);
+    f.degreesToUse = getShDegree(step);
+    if (f.degreesToUse > shAllocated) growShCoefficients(f.degreesToUse);
+    f.rgbsRaw = compute_sh_forward_split_tensor_cpu(f.degreesToUse, f.viewDirs, featuresDc.detach(), featuresRest.detach()) + 0.5f;
+    f.rgbs = torch::clamp_min(f.rgbsRaw, 0.0f);
+    f.opac = torch::sigmoid(opacities.detach());
+
+    auto r = rasterize_forward_tensor_cpu(c.width, c.height, stepXys, stepConics, f.rgbs, f.opac,
+                                          backgroundColor, stepCov2d, stepCamDepths, tileMajor,
+                                          false, nullptr, depthOrderHint(cam));
+    f.outImg = std::get<0>(r);
+    f.finalTs = std::get<1>(r);
+    f.px2gid = std::get<2>(r);
+    f.rgb = torch::clamp_max(f.outImg, 1.0f);
+}
+
+float Model::explicitStep(Camera& cam, const torch::Tensor &gt, int step, float ssimWeight){
+    torch::NoGradGuard noGrad;
+
+    ExplicitForward f;
+    explicitForward(cam, step, f);
+    const CameraConstants &c = f.camera;
+    const long long numPoints = means.size(0);
+    const int height = c.height;
+    const int width = c.width;
+    torch::Tensor &rgb = f.rgb;
+
+    // Loss: (1 - w) * L1 + w * (1 - SSIM)
+    torch::Tensor v_rgb;
+    torch::Tensor ssimVal;
+    if (tileMajor){
+        const SsimMoments *moments = gtMoments(gt, cam, f.downscaleFactor);
+        torch::Tensor planarGt = moments != nullptr ? torch::Tensor() : tile_major_to_image(gt, height, width);
+        auto s = ssim.evalBackward(tile_major_to_image(rgb, height, width), planarGt, -ssimWeight, moments);
+        ssimVal = std::get<0>(s);
+        v_rgb = image_to_tile_major(std::get<1>(s));
+    }else{
+        auto s = ssim.evalBackward(rgb, gt, -ssimWeight, gtMoments(gt, cam, f.downscaleFactor));
+        ssimVal = std::get<0>(s);
+        v_rgb = std::get<1>(s);
+    }
+    // Tile padding is zero in both images and doesn't count
+    const float numValues = static_cast<float>(height * width * 3);
+    torch::Tensor diff = rgb - gt;
+    v_rgb += torch::sign(diff) * ((1.0f - ssimWeight) / numValues);
+    float loss = (1.0f - ssimWeight) * diff.abs().sum().item<float>() / numValues + ssimWeight * (1.0f - ssimVal.item<float>());
+
+    // Backward
+    torch::Tensor v_outImg = (v_rgb * (f.outImg <= 1.0f)).contiguous();
+    torch::Tensor v_outAlpha = torch::zeros_like(f.finalTs);
+    DensificationStats *stats = nullptr;
+    if (step < stopSplitAt){
+        initDensificationStats();
+        densifyStats.radii = stepRadii;
+        stats = &densifyStats;
+    }
+    auto b = rasterize_backward_tensor_cpu(height, width, stepXys, stepConics, f.rgbs, f.opac,
+                                           backgroundColor, stepCov2d, stepCamDepths, f.finalTs,
+                                           f.px2gid, v_outImg, v_outAlpha, stats, tileMajor,
+                                           nullptr, backwardSkip, skipSeed(cam, step));
+    delete[] f.px2gid;
+
+    torch::Tensor v_xy = std::get<0>(b);
+    torch::Tensor v_conic = std::get<1>(b);
+    torch::Tensor v_rgbs = std::get<2>(b) * (f.rgbsRaw >= 0.0f);
+    torch::Tensor v_opac = std::get<3>(b);
+
+    // Footprint regularizer, see footprintLoss()
+    const float numPixels = static_cast<float>(height * width);
+    torch::Tensor areas = footprintAreas(stepConics, stepRadii, height, width);
+    coverage = (f.opac.index({Slice(), 0}) * areas).sum() / numPixels;
+    if (footprintWeight > 0.0f && coverage.item<float>() > footprintTarget){
+        // area = 9 pi / sqrt(AC - B^2), constant where clamped to the image
+        torch::Tensor A = stepConics.index({Slice(), 0});
+        torch::Tensor B = stepConics.index({Slice(), 1});
+        torch::Tensor C = stepConics.index({Slice(), 2});
+        torch::Tensor dArea = (footprintWeight / numPixels) * f.opac.index({Slice(), 0}) *
+                              (areas < numPixels).to(torch::kFloat32) * areas / torch::clamp_min(A * C - B.pow(2), 1e-12f);
+        v_conic += torch::stack({ -0.5f * dArea * C, dArea * B, -0.5f * dArea * A }, -1);
+        v_opac += (footprintWeight / numPixels) * areas.index({Slice(), None});
+    }
+    torch::Tensor v_opacity = v_opac * f.opac * (1.0f - f.opac);
+
+    torch::Tensor v_coeffs = compute_sh_backward_tensor_cpu(numPoints, shAllocated, f.degreesToUse, f.viewDirs, v_rgbs);
+
+    auto p = project_gaussians_backward_tensor_cpu(numPoints, f.means, f.scalesExp, 1.0f, f.quatsUnit,
+                                                   c.viewMat, c.projMat, c.fx, c.fy, c.cx, c.cy, height, width,
+                                                   v_xy, v_conic);
+    torch::Tensor v_means = std::get<0>(p);
+    torch::Tensor v_scales = std::get<1>(p) * f.scalesExp;
+    torch::Tensor v_quatsUnit = std::get<2>(p);
+    torch::Tensor v_quats = (v_quatsUnit - f.quatsUnit * (v_quatsUnit * f.quatsUnit).sum(-1, true)) / f.quatsNorm;
+
+    means.mutable_grad() = v_means;
+    scales.mutable_grad() = v_scales;
+    quats.mutable_grad() = v_quats;
+    featuresDc.mutable_grad() = v_coeffs.index({Slice(), 0, Slice()}).contiguous();
+    featuresRest.mutable_grad() = v_coeffs.index({Slice(), Slice(1, None), Slice()}).to(featuresRest.scalar_type());
+    opacities.mutable_grad() = v_opacity;
+
+    xys = stepXys;
+    radii = stepRadii;
+
+    return loss;
+}
+
+void Model::evalBatch(const std::vector<LmView> &batch, int step, float ssimWeight, float &loss, float &psnrMean){
+    torch::NoGradGuard noGrad;
+
+    loss = 0.0f;
+    psnrMean = 0.0f;
+    for (const LmView &v : batch){
+        ExplicitForward f;
+        explicitForward(*v.cam, step, f);
+        delete[] f.px2gid;
+
+        torch::Tensor gt = v.gt;
+        loss += mainLoss(f.rgb, gt, *v.cam, f.downscaleFactor, ssimWeight).item<float>();
+        if (tileMajor){
+            psnrMean += psnr(tile_major_to_image(f.rgb, f.camera.height, f.camera.width),
+                             tile_major_to_image(gt, f.camera.height, f.camera.width)).item<float>();
+        }else{
+            psnrMean += psnr(f.rgb, gt).item<float>();
+        }
+    }
+    loss /= static_cast<float>(batch.size());
+    psnrMean /= static_cast<float>(batch.size());
+}
+
+LmResult Model::lmStep(Camera& cam, const torch::Tensor &gt, const std::vector<LmView> &batch, int step, float ssimWeight){
+    torch::NoGradGuard noGrad;
+
+    LmResult r;
+    evalBatch(batch, step, ssimWeight, r.lossBefore, r.psnrBefore);
+
+    ExplicitForward f;
+    explicitForward(cam, step, f);
+    const int height = f.camera.height;
+    const int width = f.camera.width;
+
+    torch::Tensor residual = ((f.rgb - gt) * (f.outImg <= 1.0f)).contiguous();
+    torch::Tensor v_outAlpha = torch::zeros_like(f.finalTs);
+
+    // J^T r and the J^T J blocks w.r.t. rendered colors and opacities
+    auto b = rasterize_backward_tensor_cpu(height, width, stepXys, stepConics, f.rgbs, f.opac,
+                                           backgroundColor, stepCov2d, stepCamDepths, f.finalTs,
+                                           f.px2gid, residual, v_outAlpha, nullptr, tileMajor);
+    torch::Tensor blocks = rasterize_gauss_newton_blocks_cpu(height, width, stepXys, stepConics, f.rgbs, f.opac,
+                                                             backgroundColor, f.finalTs, f.px2gid, tileMajor);
+    delete[] f.px2gid;
+
+    // Chain to featuresDc (color = C0 * dc + ...) and opacities (sigmoid)
+    const float shC0 = 0.28209479177387814f;
+    torch::Tensor colorMask = (f.rgbsRaw >= 0.0f).to(torch::kFloat32);
+    torch::Tensor dOpac = f.opac * (1.0f - f.opac);
+    torch::Tensor gColor = std::get<2>(b) * colorMask * shC0;
+    torch::Tensor gOpac = std::get<3>(b) * dOpac;
+    torch::Tensor hColor = blocks.index({Slice(), Slice(0, 1)}) * colorMask * (shC0 * shC0);
+    torch::Tensor hCross = blocks.index({Slice(), Slice(1, 4)}) * colorMask * shC0 * dOpac;
+    torch::Tensor hOpac = blocks.index({Slice(), Slice(4, 5)}) * dOpac.pow(2);
+
+    auto l = lmLambdas.find(cam.idx);
+    float lambda = l != lmLambdas.end() ? l->second : 1.0f;
+
+    // Damped system [hColor * I, hCross; hCross^T, hOpac] solved
+    // in closed form through the Schur complement of the color block
+    const float mu = 1e-3f;
+    torch::Tensor hColorD = hColor * (1.0f + lambda) + mu;
+    torch::Tensor hOpacD = hOpac * (1.0f + lambda) + mu;
+    torch::Tensor dOpacities = (-gOpac + (hCross * gColor / hColorD).sum(-1, true)) /
+                               (hOpacD - (hCross.pow(2) / hColorD).sum(-1, true));
+    torch::Tensor dFeaturesDc = (-gColor - hCross * dOpacities) / hColorD;
+
+    featuresDc.add_(dFeaturesDc);
+    opacities.add_(dOpacities);
+
+    // The update only minimizes the L2 error of this camera
+    evalBatch(batch, step, ssimWeight, r.lossAfter, r.psnrAfter);
+    r.accepted = r.lossAfter < r.lossBefore;
+    if (r.accepted){
+        lambda = (std::max)(lambda * 0.5f, 1e-4f);
+    }else{
+        featuresDc.sub_(dFeaturesDc);
+        opacities.sub_(dOpacities);
+        lambda = (std::min)(lambda * 4.0f, 1e4f);
+        r.lossAfter = r.lossBefore;
+        r.psnrAfter = r.psnrBefore;
+    }
+    lmLambdas[cam.idx] = lambda;
+
+    return r;
+}
+
+void Model::verifyExplicitStep(Camera& cam, const torch::Tensor &gt, int step, float ssimWeight){
+    // Both passes update the densification statistics, restore them afterwards
+    torch::Tensor gradNormBefore, visCountsBefore, max2DSizeBefore;
+    const bool firstStepBefore = densifyStats.firstStep;
+    if (xysGradNorm.defined()){
+        gradNormBefore = xysGradNorm.clone();
+        visCountsBefore = visCounts.clone();
+        max2DSizeBefore = max2DSize.clone();
+    }
+
+    optimizersZeroGrad();
+    float explicitLoss = explicitStep(cam, gt, step, ssimWeight);
+    std::vector<torch::Tensor> params = { means, scales, quats, featuresDc, featuresRest, opacities };
+    std::vector<std::string> names = { "means", "scales", "quats", "featuresDc", "featuresRest", "opacities" };
+    std::vector<torch::Tensor> explicitGrads;
+    for (auto &param : params) explicitGrads.push_back(param.grad().clone());
+
+    optimizersZeroGrad();
+    torch::Tensor rgb = forward(cam, step);
+    torch::Tensor target = gt;
+    torch::Tensor loss = mainLoss(rgb, target, cam, getDownscaleFactor(step), ssimWeight);
+    float autogradLoss = loss.item<float>();
+    if (footprintWeight > 0.0f) loss = loss + footprintLoss();
+    loss.backward();
+
+    std::cout << "Explicit step check: loss " << explicitLoss << " (autograd " << autogradLoss << ")" << std::endl;
+    for (size_t i = 0; i < params.size(); i++){
+        torch::Tensor g = params[i].grad().to(torch::kFloat32);
+        float maxErr = (explicitGrads[i].to(torch::kFloat32) - g).abs().max().item<float>();
+        float maxGrad = g.abs().max().item<float>();
+        std::cout << "  " << names[i] << ": max abs error " << maxErr << " (max abs grad " << maxGrad << ")" << std::endl;
+    }
+
+    optimizersZeroGrad();
+
+    torch::NoGradGuard noGrad;
+    if (gradNormBefore.defined()){
+        xysGradNorm.copy_(gradNormBefore);
+        visCounts.copy_(visCountsBefore);
+        max2DSize.copy_(max2DSizeBefore);
+        densifyStats.firstStep = firstStepBefore;
+    }else{
+        xysGradNorm = torch::Tensor();
+        visCounts = torch::Tensor();
+        max2DSize = torch::Tensor();
+    }
+}
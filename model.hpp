@@ -5,20 +5,58 @@
 #include <torch/torch.h>
 #include <torch/csrc/api/include/torch/version.h>
 #include <vector>
+#include <unordered_map>
 #include "nerfstudio.hpp"
 #include "kdtree_tensor.hpp"
 #include "spherical_harmonics.hpp"
 #include "ssim.hpp"
 #include "input_data.hpp"
 #include "optim_scheduler.hpp"
+#include "task_scheduler.hpp"
+#include "camera_bank.hpp"
+#include "adaptive_schedule.hpp"
+#include "renderer.hpp"
+#include "lm_monitor.hpp"
 
 using namespace torch::indexing;
 using namespace torch::autograd;
 
 torch::Tensor randomQuatTensor(long long n);
-torch::Tensor projectionMatrix(float zNear, float zFar, float fovX, float fovY, const torch::Device &device);
 torch::Tensor psnr(const torch::Tensor &rendered, const torch::Tensor &gt);
 torch::Tensor l1(const torch::Tensor &rendered, const torch::Tensor &gt);
+// Area in pixels of the 3 sigma ellipses of the visible gaussians, at most the image area
+torch::Tensor footprintAreas(const torch::Tensor &conics, const torch::Tensor &radii, int height, int width);
+// Mask of the points that are in front of at least one of the cameras and
+// project within its image
+torch::Tensor seenByCameras(const torch::Tensor &points, const std::vector<Camera> &cameras);
+// Mask of the points within the axis-aligned box [boxMin, boxMax]
+torch::Tensor insideBox(const torch::Tensor &points, const torch::Tensor &boxMin, const torch::Tensor &boxMax);
+
+// Intermediate values of an explicit (autograd-free) CPU forward pass
+struct ExplicitForward{
+  CameraConstants camera;
+  int downscaleFactor;
+  int degreesToUse;
+  torch::Tensor means;
+  torch::Tensor scalesExp;
+  torch::Tensor quatsNorm;
+  torch::Tensor quatsUnit;
+  torch::Tensor viewDirs;
+  torch::Tensor rgbsRaw;
+  torch::Tensor rgbs;
+  torch::Tensor opac;
+  torch::Tensor outImg;
+  torch::Tensor finalTs;
+  torch::Tensor rgb;
+  std::vector<int32_t> *px2gid = nullptr; // must be deleted by the caller
+};
+
+// Camera and ground truth image (at the current downscale factor and
+// layout) of the batch checked by Model::lmStep()
+struct LmView{
+  Camera *cam;
+  torch::Tensor gt;
+};
 
 struct Model
 {
@@ -26,7 +64,7 @@ struct Model
         int numDownscales, int resolutionSchedule, int shDegree, int shDegreeInterval,
         int refineEvery, int warmupLength, int resetAlphaEvery, int stopSplitAt, float densifyGradThresh, float densifySizeThresh, int stopScreenSizeAt, float splitScreenSize,
         int maxSteps, const std::array<float, 3> &background,
-        const torch::Device &device) : numCameras(numCameras),
+        const torch::Device &device, torch::ScalarType shRestType = torch::kFloat32) : numCameras(numCameras),
                                        numDownscales(numDownscales), resolutionSchedule(resolutionSchedule), shDegree(shDegree), shDegreeInterval(shDegreeInterval),
                                        refineEvery(refineEvery), warmupLength(warmupLength), resetAlphaEvery(resetAlphaEvery), stopSplitAt(stopSplitAt), densifyGradThresh(densifyGradThresh), densifySizeThresh(densifySizeThresh), stopScreenSizeAt(stopScreenSizeAt), splitScreenSize(splitScreenSize),
                                        maxSteps(maxSteps),
@@ -54,7 +92,8 @@ struct Model
       quats = randomQuatTensor(numPoints).to(device).requires_grad_();
     }
 
-    int dimSh = numShBases(shDegree);
+    // Higher degrees are allocated as they get used (see growShCoefficients)
+    int dimSh = numShBases(shAllocated);
     torch::Tensor shs = torch::zeros({numPoints, dimSh, 3}, torch::TensorOptions().dtype(torch::kFloat32).device(device));
 
     shs.index({Slice(), 0, Slice(None, 3)}) = rgb2sh(inputData.points.rgb.toType(torch::kFloat64) / 255.0).toType(torch::kFloat32);
@@ -71,7 +110,10 @@ struct Model
     float base_opacities = (this->hasMeshConstraint)? 0.99f : 0.1f;
 
     featuresDc = shs.index({Slice(), 0, Slice()}).to(device).requires_grad_();
-    featuresRest = shs.index({Slice(), Slice(1, None), Slice()}).to(device).requires_grad_();
+    // Higher order SH coefficients can be stored in half precision (fp16/bf16),
+    // as well as their gradients. Only the optimizer moments stay in fp32
+    // (see stepHalfRest). They are promoted to fp32 as they are evaluated.
+    featuresRest = shs.index({Slice(), Slice(1, None), Slice()}).to(device, shRestType).requires_grad_();
     opacities = torch::logit(base_opacities * torch::ones({numPoints, 1})).to(device).requires_grad_();
 
     backgroundColor = torch::tensor({background[0], background[1], background[2]}, device);
@@ -84,6 +126,9 @@ struct Model
     opacitiesOpt = new torch::optim::Adam({opacities}, torch::optim::AdamOptions(lr_opacities));
 
     meansOptScheduler = new OptimScheduler(meansOpt, 0.0000016f, maxSteps);
+    baseSchedule = { resolutionSchedule, shDegreeInterval, refineEvery, warmupLength, stopSplitAt, stopScreenSizeAt, maxSteps };
+
+    cameraBank.build(inputData.cameras, numDownscales, device);
   }
 
   ~Model()
@@ -96,6 +141,7 @@ struct Model
     delete opacitiesOpt;
 
     delete meansOptScheduler;
+    delete adaptiveSchedule;
   }
 
   torch::Tensor forward(Camera &cam, int step);
@@ -103,10 +149,52 @@ struct Model
   void optimizersStep();
   void schedulersStep(int step);
   int getDownscaleFactor(int step);
+  int getShDegree(int step);
+  void growShCoefficients(int degree);
+  // Adam step of half precision featuresRest, see optimizersStep
+  void stepHalfRest();
+  // Bytes of featuresRest, its gradient and its optimizer moments
+  size_t shRestBytes();
+  // Continues training from the gaussians of a trained model (read with
+  // readPlySplat), to be called before the first step. Those in region are
+  // trained together with the initial points in keepPoints; the others are
+  // frozen
+  void resume(const GaussianSnapshot &s, const torch::Tensor &region, const torch::Tensor &keepPoints);
+  long long numFrozen() const { return frozen.means.defined() ? frozen.means.size(0) : 0; }
+  void enableAdaptiveSchedule(int window, float plateauThresh);
+  void observeLoss(int step, float loss);
+  // Scales the step counts of the resolution, SH, densification and
+  // learning rate schedules given to the constructor by s
+  void setScheduleScale(float s);
   void afterTrain(int step);
-  void savePlySplat(const std::string &filename);
+  void initDensificationStats();
+  // Drops the CPU rasterizer and SSIM caches and halves their budgets,
+  // returns the number of bytes released
+  size_t shrinkCaches();
+  void savePlySplat(const std::string &filename, bool async = false);
+  void waitForSnapshots();
   void saveDebugPly(const std::string &filename);
-  torch::Tensor mainLoss(torch::Tensor &rgb, torch::Tensor &gt, float ssimWeight);
+  GaussianSnapshot snapshot(int step);
+  // Loss of rgb against gt, the ground truth of cam at downscaleFactor
+  torch::Tensor mainLoss(torch::Tensor &rgb, torch::Tensor &gt, const Camera &cam, int downscaleFactor, float ssimWeight);
+  // footprintWeight * max(0, coverage - footprintTarget), bounding the
+  // rasterization cost by the average number of gaussians per pixel
+  torch::Tensor footprintLoss();
+
+  // CPU only: runs forward, loss and backward as a fixed sequence of kernels
+  // without building an autograd graph. Sets the gradients of the
+  // parameters (and xys, radii for afterTrain) and returns the loss
+  float explicitStep(Camera &cam, const torch::Tensor &gt, int step, float ssimWeight);
+  // Compares the gradients of explicitStep with those computed by autograd
+  void verifyExplicitStep(Camera &cam, const torch::Tensor &gt, int step, float ssimWeight);
+  void explicitForward(Camera &cam, int step, ExplicitForward &f);
+  // CPU only: Levenberg-Marquardt update of featuresDc and opacities on the L2
+  // error of a camera, solving the 4x4 Gauss-Newton system of each gaussian.
+  // The step is kept only if it lowers the training loss over batch, which
+  // should span other cameras than cam
+  LmResult lmStep(Camera &cam, const torch::Tensor &gt, const std::vector<LmView> &batch, int step, float ssimWeight);
+  // Training loss and PSNR averaged over batch, see lmStep()
+  void evalBatch(const std::vector<LmView> &batch, int step, float ssimWeight, float &loss, float &psnrMean);
 
   void addToOptimizer(torch::optim::Adam *optimizer, const torch::Tensor &newParam, const torch::Tensor &idcs, int nSamples);
   void removeFromOptimizer(torch::optim::Adam *optimizer, const torch::Tensor &newParam, const torch::Tensor &deletedMask);
@@ -125,15 +213,83 @@ struct Model
   torch::optim::Adam *opacitiesOpt;
 
   OptimScheduler *meansOptScheduler;
+  AdaptiveSchedule *adaptiveSchedule = nullptr;
 
   torch::Tensor radii; // set in forward()
   torch::Tensor xys;   // set in forward()
   int lastHeight;      // set in forward()
   int lastWidth;       // set in forward()
+  torch::Tensor coverage; // opacity-weighted footprint of the gaussians per pixel, set in forward()
+
+  float footprintWeight = 0.0f;
+  float footprintTarget = 0.0f;
+
+  // CPU only: renders, ground truth and gradients use the tile-major
+  // layout of the CPU rasterizer (see image_to_tile_major)
+  bool tileMajor = false;
+
+  // CPU only: the forward pass keeps the blended (id, alpha) pairs for the
+  // backward pass when they are estimated to take at most this many bytes
+  size_t alphaStackBudget = 0;
+  AlphaStack alphaStack;
+  size_t alphaStackPixels = 0; // pixels of the render that filled alphaStack.numEntries
 
-  torch::Tensor xysGradNorm; // set in afterTrain()
-  torch::Tensor visCounts;   // set in afterTrain()
+  // CPU only: depth order of the last render of each camera, the starting
+  // point of the sort of the next one. Cleared when gaussians are added or
+  // removed. Cameras are cached while the orders fit in depthOrderBudget bytes
+  size_t depthOrderBudget = 0;
+  std::unordered_map<int, std::vector<int32_t>> depthOrders;
+  std::vector<int32_t> *depthOrderHint(const Camera &cam);
+
+  // SSIM moments of the ground truth of each camera at the current
+  // downscale factor, kept while they fit in ssimCacheBudget bytes
+  size_t ssimCacheBudget = 0;
+  std::unordered_map<int, SsimMoments> ssimMoments;
+  size_t ssimMomentsBytes = 0;
+  int ssimMomentsLevel = 0;
+  SsimMoments uncachedMoments;
+  // Moments of gt, the ground truth of cam at downscaleFactor
+  const SsimMoments *gtMoments(const torch::Tensor &gt, const Camera &cam, int downscaleFactor);
+
+  // CPU only: tiles with a loss gradient below backwardSkip times the average
+  // of the image are sampled in the backward pass, see rasterize_backward_tensor_cpu
+  float backwardSkip = 0.0f;
+  int64_t skipSeed(const Camera &cam, int step) const { return static_cast<int64_t>(step) * 1000003 + cam.idx; }
+
+  // Preallocated projection outputs of explicitStep()
+  torch::Tensor stepXys;
+  torch::Tensor stepRadii;
+  torch::Tensor stepConics;
+  torch::Tensor stepCov2d;
+  torch::Tensor stepCamDepths;
+
+  torch::Tensor xysGradNorm; // set in afterTrain() or by the CPU rasterizer
+  torch::Tensor visCounts;   // set in afterTrain() or by the CPU rasterizer
   torch::Tensor max2DSize;   // set in afterTrain()
+  DensificationStats densifyStats; // updated by the CPU rasterizer backward
+
+  // Gaussians of a resumed model outside of the retrained region. They are
+  // rendered with the others, but have no gradients, optimizer state or densification
+  GaussianSnapshot frozen;
+
+  // Projection outputs, colors and opacities of the frozen gaussians in view
+  // of a camera. Those of each camera at the current downscale factor are
+  // kept while they fit in frozenCacheBudget bytes
+  struct FrozenView{
+    std::vector<torch::Tensor> proj;
+    torch::Tensor rgbs;
+    torch::Tensor opacities;
+  };
+  size_t frozenCacheBudget = 0;
+  std::unordered_map<int, FrozenView> frozenViews;
+  size_t frozenViewsBytes = 0;
+  int frozenViewsLevel = 0;
+  FrozenView frozenView(const Camera &cam, const CameraConstants &cc, int scaleFactor);
+
+  std::unordered_map<int, float> lmLambdas; // damping of lmStep() by camera
+
+  TaskGroup snapshotWrites{TaskPriority::SnapshotIO};
+  CameraBank cameraBank;
 
   torch::Tensor backgroundColor;
   torch::Device device;
@@ -143,6 +299,8 @@ struct Model
   int numDownscales;
   int resolutionSchedule;
   int shDegree;
+  int shAllocated = 0; // degree of the coefficients stored in featuresRest
+  int shStart = 0; // the SH schedule starts at this degree, that of the resumed model
   int shDegreeInterval;
   int refineEvery;
   int warmupLength;
@@ -153,6 +311,18 @@ struct Model
   int stopScreenSizeAt;
   float splitScreenSize;
   int maxSteps;
+  long long maxGaussians = 0; // densification never grows the model past this count (0 = no limit)
+  bool growthPaused = false;  // densification only culls
+
+  struct{
+    int resolutionSchedule;
+    int shDegreeInterval;
+    int refineEvery;
+    int warmupLength;
+    int stopSplitAt;
+    int stopScreenSizeAt;
+    int maxSteps;
+  } baseSchedule;
 
   float scale;
   torch::Tensor translation;
@@ -230,6 +230,7 @@ namespace ns
             throw std::runtime_error("ply_file_path is empty (and no mesh input)");
 
         ret.backgroundColor = t.backgroundColor;
+        ret.sourceFiles = { transformsPath.string(), hasMeshInput ? meshInput : (nsRoot / t.plyFilePath).string() };
 
         PointSet *pSet = nullptr;
         std::shared_ptr<MeshConstraint> meshctr = nullptr;
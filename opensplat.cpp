@@ -1,35 +1,100 @@
+#include <atomic>
 #include <filesystem>
+#include <map>
+#include <set>
 #include "vendor/json/json.hpp"
 #include "opensplat.hpp"
 #include "input_data.hpp"
+#include "gsplat.hpp"
 #include "utils.hpp"
 #include "cv_utils.hpp"
+#include "task_scheduler.hpp"
+#include "validation.hpp"
+#include "tile_export.hpp"
+#include "time_budget.hpp"
+#include "result_cache.hpp"
+#include "memory_governor.hpp"
 #include "vendor/cxxopts.hpp"
 
 namespace fs = std::filesystem;
 using namespace torch::indexing;
 
+// Values of all options (given or default) that can change the output scene
+static std::vector<std::pair<std::string, std::string>> effectiveOptions(const cxxopts::ParseResult &result){
+    const std::set<std::string> ignored = { "input", "output", "tiles-output", "cache-dir", "save-every", "resume",
+                                            "val-render", "num-threads", "pin-threads", "help" };
+    std::map<std::string, std::string> values;
+    for (const auto &kv : result.defaults()) values[kv.key()] = kv.value();
+
+    // Repeated options (vectors) keep all their values in order, joined the
+    // way cxxopts splits them
+    std::set<std::string> given;
+    for (const auto &kv : result.arguments()){
+        if (given.insert(kv.key()).second) values[kv.key()] = kv.value();
+        else values[kv.key()] += "," + kv.value();
+    }
+
+    std::vector<std::pair<std::string, std::string>> options;
+    for (const auto &kv : values){
+        if (ignored.find(kv.first) == ignored.end()) options.push_back(kv);
+    }
+    return options;
+}
+
 int main(int argc, char *argv[]){
+    const auto programStart = std::chrono::steady_clock::now();
     cxxopts::Options options("opensplat", "Open Source 3D Gaussian Splats generator");
     options.add_options()
         ("i,input", "Path to nerfstudio project", cxxopts::value<std::string>())
         ("o,output", "Path where to save output scene", cxxopts::value<std::string>()->default_value("splat.ply"))
         ("s,save-every", "Save output scene every these many steps (set to -1 to disable)", cxxopts::value<int>()->default_value("-1"))
+        ("tiles-output", "Also write the output scene as an octree of quantized chunks for streaming to this directory", cxxopts::value<std::string>()->default_value(""))
+        ("cache-dir", "Directory of a cache of outputs by hash of the input files and options. Repeated jobs restore the output scene, [tiles-output] and losses.txt from it instead of training", cxxopts::value<std::string>()->default_value(""))
+        ("tile-node-size", "Maximum number of gaussians per chunk of [tiles-output]", cxxopts::value<int>()->default_value("16384"))
         ("val", "Withhold a camera shot for validating the scene loss")
         ("val-image", "Filename of the image to withhold for validating scene loss", cxxopts::value<std::string>()->default_value("random"))
         ("val-render", "Path of the directory where to render validation images", cxxopts::value<std::string>()->default_value(""))
         ("val-every", "Dump evaluation images every this amount of iterations", cxxopts::value<int>()->default_value("50"))
+        ("val-cameras", "Number of evenly spaced cameras to render for validation (0 = all)", cxxopts::value<int>()->default_value("0"))
+        ("val-metrics", "Report PSNR and SSIM of the validation renders instead of writing images (appended to metrics.csv in [val-render] if set)")
+        ("holdout-every", "Exclude every N-th camera (sorted by filename) from training, to evaluate with opensplat-eval (0 = disabled)", cxxopts::value<int>()->default_value("0"))
+        ("holdout-list", "Comma separated filenames of images to exclude from training", cxxopts::value<std::vector<std::string>>()->default_value(""))
         ("cpu", "Force CPU execution")
+        ("num-threads", "Number of worker threads shared by the CPU kernels, image loading and background writers (0 = all cores)", cxxopts::value<int>()->default_value("0"))
+        ("pin-threads", "Pin each worker thread to its own CPU core")
+        ("explicit-step", "Run CPU training steps as a fixed sequence of kernels instead of building an autograd graph")
+        ("verify-explicit-step", "Compare the gradients of [explicit-step] with autograd on the first step")
+        ("footprint-weight", "Weight of the penalty on the opacity-weighted screen area of the gaussians above [footprint-target], which bounds rasterization cost (0 to disable)", cxxopts::value<float>()->default_value("0"))
+        ("footprint-target", "Average number of gaussians per pixel (opacity-weighted) allowed before [footprint-weight] applies", cxxopts::value<float>()->default_value("0"))
+        ("tile-major", "Keep ground truth images and render buffers in 16x16 tiles with planar channels (CPU only)")
+        ("ssim-cache-mb", "Keep the local means and variances of the ground truth images used by SSIM in up to these many MB, instead of computing them at every step (0 to disable)", cxxopts::value<int>()->default_value("1024"))
+        ("sort-cache-mb", "Keep the depth order of the gaussians of each camera in up to these many MB, so that the CPU rasterizer only fixes it on the next visit instead of sorting from scratch (0 to disable)", cxxopts::value<int>()->default_value("512"))
+        ("backward-skip", "In the backward pass, tiles whose loss gradient is below this fraction of the average of the tiles of the image are only processed with a probability proportional to their gradient (at least 10%), and reweighted so that the gradient stays unbiased. Densification only looks at the tiles always processed. Makes the backward cost follow the error left (CPU only, 0 to disable)", cxxopts::value<float>()->default_value("0"))
+        ("alpha-stack-mb", "Keep the (gaussian, alpha) pairs blended by the CPU rasterizer for its backward pass when they are estimated to fit in these many MB, which skips re-evaluating the gaussians (0 to disable)", cxxopts::value<int>()->default_value("1024"))
+        ("lm-after", "After these many steps, follow each optimizer step with a Levenberg-Marquardt refinement of the colors and opacities (CPU only, -1 to disable). Refinements are turned off when they gain less PSNR per second than the optimizer on the [lm-cameras]", cxxopts::value<int>()->default_value("-1"))
+        ("lm-cameras", "Number of cameras, spread over the input, on which the training loss must decrease for a Levenberg-Marquardt refinement to be kept", cxxopts::value<int>()->default_value("4"))
         
+        ("resume", "Continue training this .ply model of the same scene (written by opensplat) in the region seen by the cameras of the input, within the extent of its points. Gaussians outside of the region are frozen. Training starts at the SH degree of the model and, unless [num-downscales] is given, at full resolution", cxxopts::value<std::string>()->default_value(""))
+        ("resume-box", "Region of [resume] as a box in the coordinates of the output scene: minX,minY,minZ,maxX,maxY,maxZ", cxxopts::value<std::vector<float>>())
+        ("frozen-cache-mb", "Keep the projection and colors of the frozen gaussians of [resume] seen by each camera in up to these many MB, instead of computing them at every step (0 to disable)", cxxopts::value<int>()->default_value("1024"))
         ("mesh-file", "Filename of a .ply file specifying the gaussians defining the structure of input", cxxopts::value<std::string>()->default_value(""))
         ("fixed", "No spliting/duplicating/pruning of gaussians")
+        ("max-point-error", "Only start from the COLMAP points with a reprojection error of at most these many pixels (0 to keep all)", cxxopts::value<float>()->default_value("0"))
+        ("min-track-length", "Only start from the COLMAP points seen by at least these many images (0 to keep all)", cxxopts::value<int>()->default_value("0"))
 
         ("n,num-iters", "Number of iterations to run", cxxopts::value<int>()->default_value("30000"))
+        ("time-budget", "Write the output scene within these many minutes (including loading). Schedules are scaled to the number of steps that fit, at most [num-iters], and densification stops when new gaussians threaten the budget (0 = disabled)", cxxopts::value<float>()->default_value("0"))
+        ("memory-limit", "Resident memory (in MB) to stay under. As usage gets closer, cached image levels are evicted, then the rasterizer and SSIM caches shrink, then the densification gradient threshold is raised and finally densification is paused (0 = the cgroup limit or the physical memory, -1 to disable)", cxxopts::value<int>()->default_value("0"))
+        ("keep-image-levels", "Keep the full resolution images and all their downscaled levels in memory for the whole run. Otherwise only the images of the level of [resolution-schedule] in use are kept, and they are read again from disk when the schedule moves to a finer level")
         ("d,downscale-factor", "Scale input images by this factor.", cxxopts::value<float>()->default_value("1"))
         ("num-downscales", "Number of images downscales to use. After being scaled by [downscale-factor], images are initially scaled by a further (2^[num-downscales]) and the scale is increased every [resolution-schedule]", cxxopts::value<int>()->default_value("2"))
         ("resolution-schedule", "Double the image resolution every these many steps", cxxopts::value<int>()->default_value("3000"))
         ("sh-degree", "Maximum spherical harmonics degree (must be > 0)", cxxopts::value<int>()->default_value("3"))
+        ("sh-precision", "Storage precision of the higher order spherical harmonics coefficients (fp32, fp16 or bf16). Half precision types store the coefficients and their gradients in 2 bytes, updated with stochastic rounding, while the optimizer moments stay in fp32: training needs a quarter less memory for them; bf16 is less prone to underflow", cxxopts::value<std::string>()->default_value("fp32"))
         ("sh-degree-interval", "Increase the number of spherical harmonics degree after these many steps (will not exceed [sh-degree])", cxxopts::value<int>()->default_value("1000"))
+        ("adaptive-schedule", "Increase the image resolution, then the spherical harmonics degree, as soon as the loss stops improving. [resolution-schedule] and [sh-degree-interval] become the maximum number of steps spent on each")
+        ("plateau-window", "Number of steps over which the loss is smoothed and compared when using [adaptive-schedule]", cxxopts::value<int>()->default_value("200"))
+        ("plateau-thresh", "Minimum relative loss improvement per [plateau-window] steps below which [adaptive-schedule] moves to the next stage", cxxopts::value<float>()->default_value("0.005"))
         ("ssim-weight", "Weight to apply to the structural similarity loss. Set to zero to use least absolute deviation (L1) loss only", cxxopts::value<float>()->default_value("0.2"))
         ("refine-every", "Split/duplicate/prune gaussians every these many steps", cxxopts::value<int>()->default_value("100"))
         ("warmup-length", "Split/duplicate/prune gaussians only after these many steps", cxxopts::value<int>()->default_value("500"))
@@ -63,18 +128,39 @@ int main(int argc, char *argv[]){
     const std::string projectRoot = result["input"].as<std::string>();
     const std::string outputScene = result["output"].as<std::string>();
     const int saveEvery = result["save-every"].as<int>(); 
+    const std::string tilesOutput = result["tiles-output"].as<std::string>();
+    const std::string cacheDir = result["cache-dir"].as<std::string>();
+    std::vector<float> resumeBox;
+    if (result.count("resume-box")) resumeBox = result["resume-box"].as<std::vector<float>>();
+    const int tileNodeSize = result["tile-node-size"].as<int>();
     const bool validate = result.count("val") > 0 || result.count("val-render") > 0;
     const std::string valImage = result["val-image"].as<std::string>();
     const std::string valRender = result["val-render"].as<std::string>();
     const int valEvery = result["val-every"].as<int>();
+    const int valCameras = result["val-cameras"].as<int>();
+    const int holdoutEvery = result["holdout-every"].as<int>();
+    const float maxPointError = result["max-point-error"].as<float>();
+    const int minTrackLength = result["min-track-length"].as<int>();
+    std::vector<std::string> holdoutList = result["holdout-list"].as<std::vector<std::string>>();
+    holdoutList.erase(std::remove(holdoutList.begin(), holdoutList.end(), ""), holdoutList.end());
+    const bool valMetrics = result.count("val-metrics") > 0;
     if (!valRender.empty() && !fs::exists(valRender)) fs::create_directories(valRender);
 
     const float downScaleFactor = (std::max)(result["downscale-factor"].as<float>(), 1.0f);
     const int numIters = result["num-iters"].as<int>();
-    const int numDownscales = result["num-downscales"].as<int>();
+    const float timeBudget = result["time-budget"].as<float>();
+    const int memoryLimitMb = result["memory-limit"].as<int>();
+    const bool keepImageLevels = result.count("keep-image-levels") > 0;
+    const std::string resumeModel = result["resume"].as<std::string>();
+    // A resumed model is already trained at full resolution
+    const int numDownscales = !resumeModel.empty() && result.count("num-downscales") == 0 ? 0 : result["num-downscales"].as<int>();
     const int resolutionSchedule = result["resolution-schedule"].as<int>();
     const int shDegree = result["sh-degree"].as<int>();
     const int shDegreeInterval = result["sh-degree-interval"].as<int>();
+    const std::string shPrecision = result["sh-precision"].as<std::string>();
+    const bool adaptiveSchedule = result.count("adaptive-schedule") > 0;
+    const int plateauWindow = result["plateau-window"].as<int>();
+    const float plateauThresh = result["plateau-thresh"].as<float>();
     const float ssimWeight = result["ssim-weight"].as<float>();
     const int refineEvery = (fixedPoints)? 2 * numIters : result["refine-every"].as<int>();
     const int warmupLength = result["warmup-length"].as<int>();
@@ -88,6 +174,35 @@ int main(int argc, char *argv[]){
     const std::string meshInput = result["mesh-file"].as<std::string>();
     const bool hasMeshInput = meshInput.size() > 0;
 
+    const int numThreads = result["num-threads"].as<int>();
+    const bool pinThreads = result.count("pin-threads") > 0;
+    const bool useExplicitStep = result.count("explicit-step") > 0;
+    const bool verifyExplicitStep = result.count("verify-explicit-step") > 0;
+    int lmAfter = result["lm-after"].as<int>();
+    const int lmCameras = (std::max)(result["lm-cameras"].as<int>(), 1);
+    const bool tileMajor = result.count("tile-major") > 0;
+    const float footprintWeight = result["footprint-weight"].as<float>();
+    const float footprintTarget = result["footprint-target"].as<float>();
+    const int alphaStackMb = result["alpha-stack-mb"].as<int>();
+    const int sortCacheMb = result["sort-cache-mb"].as<int>();
+    const int ssimCacheMb = result["ssim-cache-mb"].as<int>();
+    const int frozenCacheMb = result["frozen-cache-mb"].as<int>();
+    const float backwardSkip = result["backward-skip"].as<float>();
+
+    // A single pool of workers serves all our parallel work. libtorch's
+    // intra-op pool gets the same size for the tensor ops of this thread,
+    // which run while the workers are idle; workers run theirs serially
+    TaskScheduler::instance().configure(numThreads, pinThreads);
+    torch::set_num_threads(TaskScheduler::instance().numWorkers());
+
+    torch::ScalarType shRestType = torch::kFloat32;
+    if (shPrecision == "fp16") shRestType = torch::kFloat16;
+    else if (shPrecision == "bf16") shRestType = torch::kBFloat16;
+    else if (shPrecision != "fp32"){
+        std::cerr << "Invalid --sh-precision: " << shPrecision << " (must be fp32, fp16 or bf16)" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     torch::Device device = torch::kCPU;
     int displayStep = 1;
 
@@ -99,27 +214,118 @@ int main(int argc, char *argv[]){
         std::cout << "Using CPU" << std::endl;
     }
 
+    if (useExplicitStep && device != torch::kCPU){
+        std::cerr << "--explicit-step requires --cpu" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!resumeModel.empty() && (useExplicitStep || lmAfter >= 0 || hasMeshInput)){
+        std::cerr << "--resume cannot be used with --explicit-step, --lm-after or --mesh-file" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!resumeBox.empty() && resumeBox.size() != 6){
+        std::cerr << "--resume-box must have 6 values" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (lmAfter >= 0 && device != torch::kCPU){
+        std::cerr << "--lm-after requires --cpu" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (timeBudget > 0.0f && adaptiveSchedule){
+        std::cerr << "--time-budget cannot be used with --adaptive-schedule" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (tileMajor && device != torch::kCPU){
+        std::cerr << "--tile-major requires --cpu" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     try{
         InputData inputData = inputDataFromX(projectRoot, meshInput);
         for(int i=0; i<inputData.cameras.size(); i++) inputData.cameras[i].idx = i;
-        for (Camera &cam : inputData.cameras){
-            // ! on nerfstudio/colmap, I guess we'd have to put "true" here ?
-            cam.loadImage(downScaleFactor, true);
+        if ((maxPointError > 0.0f || minTrackLength > 0) && !inputData.points.error.defined()){
+            throw std::runtime_error("--max-point-error and --min-track-length only apply to COLMAP projects");
         }
 
-        
+        std::unique_ptr<ResultCache> resultCache;
+        std::string jobKey;
+        if (!cacheDir.empty()){
+            if (!resumeModel.empty()) inputData.sourceFiles.push_back(resumeModel);
+            resultCache = std::make_unique<ResultCache>(cacheDir);
+            jobKey = jobHash(inputData, effectiveOptions(result));
+            if (resultCache->restore(jobKey, outputScene, tilesOutput)){
+                std::cout << "Restored " << outputScene << " from the cache (" << jobKey << ")" << std::endl;
+                return EXIT_SUCCESS;
+            }
+        }
+
+        inputData.filterPoints(maxPointError, minTrackLength);
+
+        TaskScheduler::instance().parallelFor(0, inputData.cameras.size(), 1, [&](size_t start, size_t end){
+            for (size_t i = start; i < end; i++){
+                // ! on nerfstudio/colmap, I guess we'd have to put "true" here ?
+                inputData.cameras[i].loadImage(downScaleFactor, true);
+
+                // Training starts at the coarsest level
+                if (!keepImageLevels) inputData.cameras[i].keepLevel(1 << (std::max)(numDownscales, 0), tileMajor);
+            }
+        }, TaskPriority::Prefetch);
+        if (residentMemory() > 0) std::cout << "Images loaded, " << residentMemory() / (1024 * 1024) << " MB in use" << std::endl;
 
         // Withhold a validation camera if necessary
         auto t = inputData.getCameras(validate, valImage);
         std::vector<Camera> cams = std::get<0>(t);
         Camera *valCam = std::get<1>(t);
 
+        if (holdoutEvery > 0 || !holdoutList.empty()){
+            auto split = splitHoldout(cams, holdoutEvery, holdoutList);
+            cams = std::get<0>(split);
+            for (size_t i = 0; i < cams.size(); i++) cams[i].idx = i;
+            std::cout << "Holding out " << std::get<1>(split).size() << " cameras, training on " << cams.size() << std::endl;
+        }
+
+        // Levels released by cams must not stay referenced here
+        if (!keepImageLevels){
+            for (Camera &c : inputData.cameras) c.evictPyramids(0);
+        }
+
         Model model(inputData,
                     cams.size(),
                     numDownscales, resolutionSchedule, shDegree, shDegreeInterval, 
                     refineEvery, warmupLength, resetAlphaEvery, stopSplitAt, densifyGradThresh, densifySizeThresh, stopScreenSizeAt, splitScreenSize,
                     numIters, inputData.backgroundColor,
-                    device);
+                    device, shRestType);
+        if (adaptiveSchedule) model.enableAdaptiveSchedule(plateauWindow, plateauThresh);
+        model.tileMajor = tileMajor;
+        model.footprintWeight = footprintWeight;
+        model.footprintTarget = footprintTarget;
+        model.alphaStackBudget = static_cast<size_t>((std::max)(alphaStackMb, 0)) * 1024 * 1024;
+        model.depthOrderBudget = static_cast<size_t>((std::max)(sortCacheMb, 0)) * 1024 * 1024;
+        model.backwardSkip = backwardSkip;
+        model.ssimCacheBudget = static_cast<size_t>((std::max)(ssimCacheMb, 0)) * 1024 * 1024;
+        model.frozenCacheBudget = static_cast<size_t>((std::max)(frozenCacheMb, 0)) * 1024 * 1024;
+
+        if (!resumeModel.empty()){
+            GaussianSnapshot previous = readPlySplat(resumeModel, inputData.scale, inputData.translation, inputData.backgroundColor);
+            torch::Tensor points = model.means.detach().cpu();
+            torch::Tensor boxMin, boxMax;
+            torch::Tensor region, keepPoints;
+            if (!resumeBox.empty()){
+                // Same transformation as readPlySplat
+                torch::Tensor t = inputData.translation.cpu();
+                boxMin = (torch::tensor({resumeBox[0], resumeBox[1], resumeBox[2]}) - t) * inputData.scale;
+                boxMax = (torch::tensor({resumeBox[3], resumeBox[4], resumeBox[5]}) - t) * inputData.scale;
+                region = insideBox(previous.means, boxMin, boxMax);
+                keepPoints = insideBox(points, boxMin, boxMax);
+            }else{
+                // Ignore outliers of the point cloud of the new views
+                torch::Tensor q = torch::quantile(points, torch::tensor({0.01f, 0.99f}), 0);
+                boxMin = q[0];
+                boxMax = q[1];
+                region = seenByCameras(previous.means, cams) & insideBox(previous.means, boxMin, boxMax);
+                keepPoints = seenByCameras(points, cams) & insideBox(points, boxMin, boxMax);
+            }
+            model.resume(previous, region, keepPoints);
+        }
 
         std::vector< size_t > camIndices( cams.size() );
         std::iota( camIndices.begin(), camIndices.end(), 0 );
@@ -128,52 +334,182 @@ int main(int argc, char *argv[]){
         int imageSize = -1;
 
         std::vector<std::vector<float>> lossesByCamera(cams.size());
+        TaskGroup validationRuns(TaskPriority::SnapshotIO);
+        LmMonitor lmMonitor;
+        int lmDownscale = -1;
+        std::vector<size_t> lmCams;
+        const size_t numLmCams = (std::min)(static_cast<size_t>(lmCameras), cams.size());
+        for (size_t k = 0; k < numLmCams; k++) lmCams.push_back(k * cams.size() / numLmCams);
+
+        std::unique_ptr<TimeBudget> budget;
+        if (timeBudget > 0.0f){
+            budget = std::make_unique<TimeBudget>(timeBudget * 60.0, numIters, numDownscales, resolutionSchedule, warmupLength, programStart);
+            // Tile export (~3us per gaussian) and the validation render
+            if (!tilesOutput.empty()) budget->reserveAfterTraining(0, 3e-6);
+            if (valCam != nullptr) budget->reserveAfterTraining(1, 0.0);
+        }
+        size_t lastStep = numIters;
+
+        std::unique_ptr<MemoryGovernor> governor;
+        if (memoryLimitMb >= 0){
+            size_t limit = memoryLimitMb > 0 ? static_cast<size_t>(memoryLimitMb) * 1024 * 1024 : memoryLimit();
+            if (limit > 0) governor = std::make_unique<MemoryGovernor>(limit);
+        }
+        int pyramidLevel = 0; // downscale factor kept in the image caches, once they are being evicted
+        int imageLevel = keepImageLevels ? 0 : 1 << (std::max)(numDownscales, 0);
 
         for (size_t step = 1; step <= numIters; step++){
+            if (budget && budget->exhausted(model.means.size(0))){
+                lastStep = step - 1;
+                std::cout << "Time budget reached after " << lastStep << " steps" << std::endl;
+                break;
+            }
+            const auto stepStart = std::chrono::steady_clock::now();
+
+            if (!keepImageLevels && model.getDownscaleFactor(step) != imageLevel){
+                imageLevel = model.getDownscaleFactor(step);
+                std::atomic<size_t> released(0);
+                TaskScheduler::instance().parallelFor(0, cams.size(), 1, [&](size_t start, size_t end){
+                    for (size_t i = start; i < end; i++) released += cams[i].keepLevel(imageLevel, tileMajor);
+                }, TaskPriority::Prefetch);
+                std::cout << "Step " << step << ": moved images to downscale factor " << imageLevel << " ("
+                          << released / (1024 * 1024) << " MB released, " << residentMemory() / (1024 * 1024) << " MB in use)" << std::endl;
+            }
 
             Camera& cam = cams[ camsIter.next() ];
 
-            if (!valRender.empty() && step % valEvery == 0){
-                int i=0;
-                for(auto& cam: cams) {
-                    
-                    torch::Tensor rgb = model.forward(cam, step);
-                    cv::Mat image = tensorToImage(rgb.detach().cpu());
-                    cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
-                    torch::Tensor gt = cam.getImage(model.getDownscaleFactor(step));
-                    cv::Mat image_gt = tensorToImage(gt.detach().cpu());
-                    cv::cvtColor(image_gt, image_gt, cv::COLOR_RGB2BGR);
-                    cv::imwrite((fs::path(valRender) / (std::to_string(step) + "_" + std::to_string(i) + ".png")).string(), image);
-                    cv::imwrite((fs::path(valRender) / (std::to_string(step) + "_gt_" + std::to_string(i) + ".png")).string(), image_gt);
-                    i++;
+            if ((!valRender.empty() || valMetrics) && step % valEvery == 0){
+                // Rendered on the background workers from a copy of the parameters.
+                // Images are fetched here since the image pyramids are not thread safe
+                auto snapshot = std::make_shared<GaussianSnapshot>(model.snapshot(step));
+                int downscaleFactor = model.getDownscaleFactor(step);
+                size_t numValCams = valCameras > 0 ? (std::min)(static_cast<size_t>(valCameras), cams.size()) : cams.size();
+                std::vector<ValidationView> views;
+                for (size_t k = 0; k < numValCams; k++){
+                    size_t i = k * cams.size() / numValCams;
+                    CameraConstants cc = CameraBank::compute(cams[i], downscaleFactor, torch::kCPU);
+                    // Only the tiled level is kept with tileMajor
+                    torch::Tensor gt = tileMajor ? tile_major_to_image(cams[i].getTiledImage(downscaleFactor), cc.height, cc.width)
+                                                 : cams[i].getImage(downscaleFactor);
+                    views.push_back({ static_cast<int>(i), cc, gt.cpu() });
                 }
+                validateAsync(snapshot, views, step, valRender, valMetrics, validationRuns);
+            }
+
+            int downscaleFactor = model.getDownscaleFactor(step);
+            torch::Tensor gt = tileMajor ? cam.getTiledImage(downscaleFactor) : cam.getImage(downscaleFactor);
+            gt = gt.to(device);
+
+            if (useExplicitStep && verifyExplicitStep && step == 1){
+                model.verifyExplicitStep(cam, gt, step, ssimWeight);
             }
 
             model.optimizersZeroGrad();
 
-            torch::Tensor rgb = model.forward(cam, step);
-            torch::Tensor gt = cam.getImage(model.getDownscaleFactor(step));
-            gt = gt.to(device);
+            float steploss;
+            if (useExplicitStep){
+                steploss = model.explicitStep(cam, gt, step, ssimWeight);
+            }else{
+                torch::Tensor rgb = model.forward(cam, step);
+                torch::Tensor mainLoss = model.mainLoss(rgb, gt, cam, downscaleFactor, ssimWeight);
+                steploss = mainLoss.item<float>();
+                if (footprintWeight > 0.0f) mainLoss = mainLoss + model.footprintLoss();
+                mainLoss.backward();
+            }
 
             if (saveEvery > 0 && step % saveEvery == 0){
                 fs::path p(outputScene);
-                model.savePlySplat((p.replace_filename(fs::path(p.stem().string() + "_" + std::to_string(step) + p.extension().string())).string()));
+                model.savePlySplat((p.replace_filename(fs::path(p.stem().string() + "_" + std::to_string(step) + p.extension().string())).string()), true);
             }
-
-            torch::Tensor mainLoss = model.mainLoss(rgb, gt, ssimWeight);
-            mainLoss.backward();
-            float steploss = mainLoss.item<float>();
             
             lossesByCamera[cam.idx].push_back(steploss);
             
-            if (step % displayStep == 0) std::cout << "Step " << step << ": " << steploss << std::endl;
+            if (step % displayStep == 0){
+                std::cout << "Step " << step << ": " << steploss << " (" << model.coverage.item<float>() << " gaussians/pixel)" << std::endl;
+            }
 
             model.optimizersStep();
+            if (lmAfter >= 0 && step > static_cast<size_t>(lmAfter)){
+                const auto lmStart = std::chrono::steady_clock::now();
+                if (downscaleFactor != lmDownscale){
+                    lmMonitor.reset();
+                    lmDownscale = downscaleFactor;
+                }
+
+                std::vector<LmView> lmBatch;
+                for (size_t i : lmCams){
+                    lmBatch.push_back({ &cams[i], (tileMajor ? cams[i].getTiledImage(downscaleFactor) : cams[i].getImage(downscaleFactor)).to(device) });
+                }
+                LmResult r = model.lmStep(cam, gt, lmBatch, step, ssimWeight);
+
+                const auto lmEnd = std::chrono::steady_clock::now();
+                if (lmMonitor.update(r, std::chrono::duration<double>(lmStart - stepStart).count(), std::chrono::duration<double>(lmEnd - lmStart).count())){
+                    std::cout << "Step " << step << ": Levenberg-Marquardt refinements gain " << lmMonitor.lmRate() << " dB/s against "
+                              << lmMonitor.adamRate() << " dB/s for the optimizer, turning them off" << std::endl;
+                    lmAfter = -1;
+                }
+            }
             model.schedulersStep(step);
             model.afterTrain(step);
+            model.observeLoss(step, steploss);
+
+            if (budget){
+                double stepTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+                if (budget->update(step, stepTime, gt.numel() / 3, downscaleFactor)){
+                    model.setScheduleScale(static_cast<float>(budget->projectedSteps()) / numIters);
+                }
+                if (budget->growthCapped() && model.maxGaussians == 0){
+                    model.maxGaussians = model.means.size(0);
+                    std::cout << "Step " << step << ": capping the number of gaussians at " << model.maxGaussians << " to stay within the time budget" << std::endl;
+                }
+            }
+
+            if (governor){
+                for (MemoryGovernor::Action a : governor->update(step)){
+                    std::cout << "Step " << step << ": memory at " << governor->resident() / (1024 * 1024) << " of "
+                              << governor->limit() / (1024 * 1024) << " MB, " << MemoryGovernor::describe(a);
+                    if (a == MemoryGovernor::EvictPyramids){
+                        pyramidLevel = -1;
+                    }else if (a == MemoryGovernor::ShrinkCaches){
+                        std::cout << " (" << model.shrinkCaches() / (1024 * 1024) << " MB released)";
+                    }else if (a == MemoryGovernor::RaiseGradThresh){
+                        model.densifyGradThresh *= MemoryGovernor::RaiseFactor;
+                        std::cout << " to " << model.densifyGradThresh;
+                    }else if (a == MemoryGovernor::PauseSplitting){
+                        model.growthPaused = true;
+                        std::cout << " at " << model.means.size(0) << " gaussians";
+                    }
+                    std::cout << std::endl;
+                }
+
+                // Images of coarser levels are not used again, finer ones are made when needed
+                if (pyramidLevel != 0 && pyramidLevel != downscaleFactor){
+                    size_t bytes = 0;
+                    for (Camera &c : cams) bytes += c.evictPyramids(downscaleFactor);
+                    pyramidLevel = downscaleFactor;
+                    std::cout << "Step " << step << ": evicted " << bytes / (1024 * 1024) << " MB of cached images" << std::endl;
+                }
+            }
+        }
+
+        if (budget){
+            std::cout << "Time budget: " << lastStep << " steps (" << budget->projectedSteps() << " projected) in "
+                      << budget->elapsed() << "s" << std::endl;
         }
 
+        if (peakResidentMemory() > 0) std::cout << "Peak memory: " << peakResidentMemory() / (1024 * 1024) << " MB" << std::endl;
+        std::cout << "Spherical harmonics coefficients: " << model.shRestBytes() / (1024 * 1024) << " MB with their gradients and optimizer moments" << std::endl;
+
+        if (result["lm-after"].as<int>() >= 0) lmMonitor.printSummary();
+
+        if (model.adaptiveSchedule != nullptr) model.adaptiveSchedule->printSummary();
+
+        // Validation renders not started yet don't fit in the time left
+        if (budget && budget->exhausted(model.means.size(0))) validationRuns.cancel();
+        TaskScheduler::instance().wait(validationRuns);
+        model.waitForSnapshots();
         model.savePlySplat(outputScene);
+        if (!tilesOutput.empty()) writeSplatTiles(model.snapshot(lastStep), model.scale, model.translation, tilesOutput, tileNodeSize);
         // model.saveDebugPly("debug.ply");
 
         // Write losses to output file
@@ -187,7 +523,7 @@ int main(int argc, char *argv[]){
         }
         // and now, average loss by iteration
         int iteration = 0;
-        while(iteration < numIters) {
+        while(iteration < lastStep) {
             bool shouldcontinue = false;
             float avgloss = 0.f;
             int nrcams = 0;
@@ -207,11 +543,16 @@ int main(int argc, char *argv[]){
         std::cout << "Wrote losses to " << losses_path << std::endl;
         losses_write.close();
 
+        if (resultCache) resultCache->store(jobKey, outputScene, tilesOutput);
+
         // Validate
-        if (valCam != nullptr){
-            torch::Tensor rgb = model.forward(*valCam, numIters);
-            torch::Tensor gt = valCam->getImage(model.getDownscaleFactor(numIters)).to(device);
-            std::cout << valCam->filePath << " validation loss: " << model.mainLoss(rgb, gt, ssimWeight).item<float>() << std::endl; 
+        if (valCam != nullptr && budget && budget->elapsed() >= timeBudget * 60.0){
+            std::cout << "Skipping the validation of " << valCam->filePath << ", out of time" << std::endl;
+        }else if (valCam != nullptr){
+            torch::Tensor rgb = model.forward(*valCam, lastStep);
+            int downscaleFactor = model.getDownscaleFactor(lastStep);
+            torch::Tensor gt = (tileMajor ? valCam->getTiledImage(downscaleFactor) : valCam->getImage(downscaleFactor)).to(device);
+            std::cout << valCam->filePath << " validation loss: " << model.mainLoss(rgb, gt, *valCam, downscaleFactor, ssimWeight).item<float>() << std::endl; 
         }
     }catch(const std::exception &e){
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,139 @@
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include "vendor/json/json.hpp"
+#include "vendor/cxxopts.hpp"
+#include "input_data.hpp"
+#include "model.hpp"
+#include "renderer.hpp"
+#include "task_scheduler.hpp"
+#include "constants.hpp"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+int main(int argc, char *argv[]){
+    cxxopts::Options options("opensplat-eval", "Evaluate a trained splat on the held-out images of a project");
+    options.add_options()
+        ("i,input", "Path to the nerfstudio or colmap project used for training", cxxopts::value<std::string>())
+        ("m,model", "Path to the trained .ply splat", cxxopts::value<std::string>()->default_value("splat.ply"))
+        ("o,output", "Path of the JSON file with the metrics (empty = print to stdout)", cxxopts::value<std::string>()->default_value(""))
+        ("holdout-every", "Evaluate every N-th camera (sorted by filename); should match the value used for training", cxxopts::value<int>()->default_value("8"))
+        ("holdout-list", "Comma separated filenames of images to evaluate", cxxopts::value<std::vector<std::string>>()->default_value(""))
+        ("all", "Evaluate on all cameras")
+        ("d,downscale-factor", "Scale input images by this factor.", cxxopts::value<float>()->default_value("1"))
+        ("color-tolerance", "Reuse the colors of the gaussians rendered for the previous image while the direction to them turned by at most these many degrees. Colors of degree 0 models are always reused; with 0, those of higher degrees are never cached", cxxopts::value<float>()->default_value("0"))
+        ("num-threads", "Number of worker threads (0 = all cores)", cxxopts::value<int>()->default_value("0"))
+        ("h,help", "Print usage")
+        ;
+    options.parse_positional({ "input" });
+    options.positional_help("[colmap or nerfstudio project path]");
+    cxxopts::ParseResult result;
+    try {
+        result = options.parse(argc, argv);
+    }
+    catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << options.help() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (result.count("help") || !result.count("input")) {
+        std::cout << options.help() << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    const std::string projectRoot = result["input"].as<std::string>();
+    const std::string modelPath = result["model"].as<std::string>();
+    const std::string outputPath = result["output"].as<std::string>();
+    const bool evalAll = result.count("all") > 0;
+    const int holdoutEvery = result["holdout-every"].as<int>();
+    std::vector<std::string> holdoutList = result["holdout-list"].as<std::vector<std::string>>();
+    holdoutList.erase(std::remove(holdoutList.begin(), holdoutList.end(), ""), holdoutList.end());
+    const float downScaleFactor = (std::max)(result["downscale-factor"].as<float>(), 1.0f);
+    const float colorTolerance = (std::max)(result["color-tolerance"].as<float>(), 0.0f) * static_cast<float>(PI) / 180.0f;
+
+    TaskScheduler::instance().configure(result["num-threads"].as<int>());
+    torch::set_num_threads(TaskScheduler::instance().numWorkers());
+
+    try{
+        InputData inputData = inputDataFromX(projectRoot, "");
+
+        std::vector<Camera> cams = inputData.cameras;
+        if (!evalAll){
+            // An explicit list replaces the every-N-th rule
+            cams = std::get<1>(splitHoldout(inputData.cameras, holdoutList.empty() ? holdoutEvery : 0, holdoutList));
+        }
+        if (cams.empty()) throw std::runtime_error("No cameras to evaluate");
+
+        GaussianSnapshot snapshot = readPlySplat(modelPath, inputData.scale, inputData.translation, inputData.backgroundColor);
+        std::cout << "Evaluating " << snapshot.means.size(0) << " gaussians on " << cams.size() << " images" << std::endl;
+
+        std::vector<float> psnrs(cams.size()), ssims(cams.size()), l1s(cams.size());
+        std::atomic<size_t> colorsReused(0), colorsEvaluated(0);
+        // Consecutive cameras (sorted by filename) are usually close. When colors
+        // can be reused, each thread renders one long run of them with its cache
+        // (the rasterizer spreads each render over idle workers); otherwise
+        // cameras are spread in small chunks
+        const bool reuseColors = snapshot.degreesToUse == 0 || colorTolerance > 0.0f;
+        const size_t numRuns = static_cast<size_t>(TaskScheduler::instance().numWorkers()) + 1;
+        const size_t grain = reuseColors ? (cams.size() + numRuns - 1) / numRuns : 1;
+        TaskScheduler::instance().parallelFor(0, cams.size(), grain, [&](size_t start, size_t end){
+            SSIM ssim(11, 3);
+            ColorCache colors;
+            colors.tolerance = colorTolerance;
+            for (size_t i = start; i < end; i++){
+                torch::NoGradGuard noGrad;
+                cams[i].loadImage(downScaleFactor);
+                torch::Tensor gt = cams[i].getImage(1);
+                torch::Tensor rgb = renderSnapshot(snapshot, CameraBank::compute(cams[i], 1, torch::kCPU), &colors);
+
+                psnrs[i] = psnr(rgb, gt).item<float>();
+                ssims[i] = ssim.eval(rgb, gt).item<float>();
+                l1s[i] = l1(rgb, gt).item<float>();
+
+                // Release the image, we don't need it anymore
+                cams[i].image = torch::Tensor();
+                cams[i].imagePyramids.clear();
+            }
+            colorsReused += colors.reused;
+            colorsEvaluated += colors.evaluated;
+        });
+        if (colorsReused > 0){
+            std::cout << "Reused " << (100.0 * colorsReused / (colorsReused + colorsEvaluated)) << "% of the gaussian colors" << std::endl;
+        }
+
+        json j;
+        j["model"] = modelPath;
+        j["project"] = projectRoot;
+        j["images"] = json::array();
+        float psnrSum = 0.0f, ssimSum = 0.0f, l1Sum = 0.0f;
+        for (size_t i = 0; i < cams.size(); i++){
+            j["images"].push_back({
+                {"name", fs::path(cams[i].filePath).filename().string()},
+                {"psnr", psnrs[i]},
+                {"ssim", ssims[i]},
+                {"l1", l1s[i]}
+            });
+            psnrSum += psnrs[i];
+            ssimSum += ssims[i];
+            l1Sum += l1s[i];
+        }
+        const float n = static_cast<float>(cams.size());
+        j["mean"] = { {"psnr", psnrSum / n}, {"ssim", ssimSum / n}, {"l1", l1Sum / n} };
+        j["count"] = cams.size();
+
+        if (outputPath.empty()){
+            std::cout << j.dump(4) << std::endl;
+        }else{
+            std::ofstream o(outputPath);
+            o << j.dump(4) << std::endl;
+            std::cout << "Wrote " << outputPath << " (PSNR " << (psnrSum / n) << ", SSIM " << (ssimSum / n) << ", L1 " << (l1Sum / n) << ")" << std::endl;
+        }
+    }catch(const std::exception &e){
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
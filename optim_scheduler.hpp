@@ -12,6 +12,7 @@ public:
         ), lrFinal(lrFinal), maxSteps(maxSteps) {};
     void step(int step);
     float getLearningRate(int step);
+    void setMaxSteps(int steps) { maxSteps = steps; }
 
 private:
     torch::optim::Adam *opt;
@@ -369,6 +369,8 @@ PointSet *colmapReadPointSet(const std::string &filename){
 
     r->points.resize(numPoints);
     r->colors.resize(numPoints);
+    r->errors.resize(numPoints);
+    r->trackLengths.resize(numPoints);
 
     for (size_t i = 0; i < numPoints; i++){
         readBinary<uint64_t>(reader); // point ID
@@ -380,8 +382,9 @@ PointSet *colmapReadPointSet(const std::string &filename){
         r->colors[i][1] = readBinary<uint8_t>(reader);
         r->colors[i][2] = readBinary<uint8_t>(reader);
 
-        readBinary<double>(reader); // error
+        r->errors[i] = static_cast<float>(readBinary<double>(reader));
         size_t trackLen = readBinary<uint64_t>(reader);
+        r->trackLengths[i] = static_cast<uint32_t>(trackLen);
         for (size_t j = 0; j < trackLen; j++){
             readBinary<uint32_t>(reader); // imageId
             readBinary<uint32_t>(reader); // point2D Idx
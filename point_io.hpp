@@ -31,6 +31,10 @@ struct PointSet {
     std::vector<std::array<float, 3> > normals;
     std::vector<uint8_t> views;
 
+    // COLMAP only: reprojection error (pixels) and track length of each point
+    std::vector<float> errors;
+    std::vector<uint32_t> trackLengths;
+
     void *kdTree = nullptr;
 
     #ifdef WITH_PDAL
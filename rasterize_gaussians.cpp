@@ -151,7 +151,13 @@ torch::Tensor RasterizeGaussiansCPU::forward(AutogradContext *ctx,
             torch::Tensor camDepths,
             int imgHeight,
             int imgWidth,
-            torch::Tensor background
+            torch::Tensor background,
+            DensificationStats *stats,
+            bool tileMajor,
+            AlphaStack *alphaStack,
+            std::vector<int32_t> *depthOrder,
+            float skipThreshold,
+            int64_t skipSeed
         ){
     
     int numPoints = xys.size(0);
@@ -163,7 +169,11 @@ torch::Tensor RasterizeGaussiansCPU::forward(AutogradContext *ctx,
                             opacity,
                             background,
                             cov2d,
-                            camDepths
+                            camDepths,
+                            tileMajor,
+                            false,
+                            alphaStack,
+                            depthOrder
                             );
     // Final image
     torch::Tensor outImg = std::get<0>(t);
@@ -174,16 +184,26 @@ torch::Tensor RasterizeGaussiansCPU::forward(AutogradContext *ctx,
     ctx->saved_data["imgWidth"] = imgWidth;
     ctx->saved_data["imgHeight"] = imgHeight;
     ctx->saved_data["px2gid"] = reinterpret_cast<int64_t>(px2gid);
+    ctx->saved_data["stats"] = reinterpret_cast<int64_t>(stats);
+    ctx->saved_data["tileMajor"] = tileMajor;
+    ctx->saved_data["alphaStack"] = reinterpret_cast<int64_t>(alphaStack);
+    ctx->saved_data["skipThreshold"] = static_cast<double>(skipThreshold);
+    ctx->saved_data["skipSeed"] = skipSeed;
     ctx->save_for_backward({ xys, conics, colors, opacity, background, cov2d, camDepths, finalTs });
     
     return outImg;
 }
 
 tensor_list RasterizeGaussiansCPU::backward(AutogradContext *ctx, tensor_list grad_outputs) {
-    torch::Tensor v_outImg = grad_outputs[0];
+    torch::Tensor v_outImg = grad_outputs[0].contiguous();
     int imgHeight = ctx->saved_data["imgHeight"].toInt();
     int imgWidth = ctx->saved_data["imgWidth"].toInt();
     const std::vector<int32_t> *px2gid = reinterpret_cast<const std::vector<int32_t> *>(ctx->saved_data["px2gid"].toInt());
+    DensificationStats *stats = reinterpret_cast<DensificationStats *>(ctx->saved_data["stats"].toInt());
+    bool tileMajor = ctx->saved_data["tileMajor"].toBool();
+    const AlphaStack *alphaStack = reinterpret_cast<const AlphaStack *>(ctx->saved_data["alphaStack"].toInt());
+    float skipThreshold = static_cast<float>(ctx->saved_data["skipThreshold"].toDouble());
+    int64_t skipSeed = ctx->saved_data["skipSeed"].toInt();
 
     variable_list saved = ctx->get_saved_variables();
     torch::Tensor xys = saved[0];
@@ -195,7 +215,7 @@ tensor_list RasterizeGaussiansCPU::backward(AutogradContext *ctx, tensor_list gr
     torch::Tensor camDepths = saved[6];
     torch::Tensor finalTs = saved[7];
 
-    torch::Tensor v_outAlpha = torch::zeros_like(v_outImg.index({"...", 0}));
+    torch::Tensor v_outAlpha = torch::zeros_like(finalTs);
     
     auto t = rasterize_backward_tensor_cpu(imgHeight, imgWidth, 
                             xys,
@@ -208,7 +228,12 @@ tensor_list RasterizeGaussiansCPU::backward(AutogradContext *ctx, tensor_list gr
                             finalTs,
                             px2gid,
                             v_outImg,
-                            v_outAlpha);
+                            v_outAlpha,
+                            stats,
+                            tileMajor,
+                            alphaStack,
+                            skipThreshold,
+                            static_cast<uint64_t>(skipSeed));
 
     delete[] px2gid;
 
@@ -228,7 +253,13 @@ tensor_list RasterizeGaussiansCPU::backward(AutogradContext *ctx, tensor_list gr
             none, // camDepths
             none, // imgHeight
             none, // imgWidth
-            none // background
+            none, // background
+            none, // stats
+            none, // tileMajor
+            none, // alphaStack
+            none, // depthOrder
+            none, // skipThreshold
+            none // skipSeed
     };
 }
 
@@ -3,6 +3,7 @@
 
 #include <torch/torch.h>
 #include "tile_bounds.hpp"
+#include "gsplat.hpp"
 
 using namespace torch::autograd;
 
@@ -50,7 +51,13 @@ public:
             torch::Tensor camDepths,
             int imgHeight,
             int imgWidth,
-            torch::Tensor background);
+            torch::Tensor background,
+            DensificationStats *stats,
+            bool tileMajor = false,
+            AlphaStack *alphaStack = nullptr,
+            std::vector<int32_t> *depthOrder = nullptr,
+            float skipThreshold = 0.0f,
+            int64_t skipSeed = 0);
     static tensor_list backward(AutogradContext *ctx, tensor_list grad_outputs);
 };
 
@@ -0,0 +1,132 @@
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <tinyply.h>
+#include "renderer.hpp"
+#include "gsplat.hpp"
+#include "spherical_harmonics.hpp"
+
+GaussianSnapshot readPlySplat(const std::string &filename, float scale, const torch::Tensor &translation,
+                              const std::array<float, 3> &background){
+    std::ifstream f(filename, std::ios::binary);
+    if (!f.is_open()) throw std::runtime_error("Cannot open " + filename);
+
+    tinyply::PlyFile ply;
+    ply.parse_header(f);
+
+    int numRest = 0;
+    for (const auto &e : ply.get_elements()){
+        if (e.name != "vertex") continue;
+        for (const auto &p : e.properties){
+            if (p.name.rfind("f_rest_", 0) == 0) numRest++;
+        }
+    }
+    std::vector<std::string> restNames;
+    for (int i = 0; i < numRest; i++) restNames.push_back("f_rest_" + std::to_string(i));
+
+    std::shared_ptr<tinyply::PlyData> means = ply.request_properties_from_element("vertex", {"x", "y", "z"});
+    std::shared_ptr<tinyply::PlyData> dc = ply.request_properties_from_element("vertex", {"f_dc_0", "f_dc_1", "f_dc_2"});
+    std::shared_ptr<tinyply::PlyData> rest;
+    if (numRest > 0) rest = ply.request_properties_from_element("vertex", restNames);
+    std::shared_ptr<tinyply::PlyData> opacities = ply.request_properties_from_element("vertex", {"opacity"});
+    std::shared_ptr<tinyply::PlyData> scales = ply.request_properties_from_element("vertex", {"scale_0", "scale_1", "scale_2"});
+    std::shared_ptr<tinyply::PlyData> quats = ply.request_properties_from_element("vertex", {"rot_0", "rot_1", "rot_2", "rot_3"});
+    ply.read(f);
+
+    if (means->t != tinyply::Type::FLOAT32) throw std::runtime_error(filename + " must store float properties");
+
+    auto toTensor = [](const std::shared_ptr<tinyply::PlyData> &d, long long cols){
+        long long n = static_cast<long long>(d->count);
+        return torch::from_blob(d->buffer.get(), {n, cols}, torch::kFloat32).clone();
+    };
+
+    GaussianSnapshot s;
+    long long numPoints = static_cast<long long>(means->count);
+
+    // Undo the transformation applied by savePlySplat
+    s.means = ((toTensor(means, 3) - translation.cpu()) * scale).contiguous();
+    s.scales = torch::exp(toTensor(scales, 3) + std::log(scale)).contiguous();
+    torch::Tensor q = toTensor(quats, 4);
+    s.quats = (q / q.norm(2, {-1}, true)).contiguous();
+    s.opacities = torch::sigmoid(toTensor(opacities, 1)).contiguous();
+
+    // f_rest is stored channel-major
+    torch::Tensor shDc = toTensor(dc, 3).index({torch::indexing::Slice(), torch::indexing::None, torch::indexing::Slice()});
+    if (numRest > 0){
+        torch::Tensor shRest = toTensor(rest, numRest).reshape({numPoints, 3, numRest / 3}).transpose(1, 2);
+        s.shs = torch::cat({shDc, shRest}, 1).contiguous();
+    }else{
+        s.shs = shDc.contiguous();
+    }
+    s.shDegree = degFromSh(s.shs.size(1));
+    s.degreesToUse = s.shDegree;
+    s.background = torch::tensor({background[0], background[1], background[2]});
+
+    return s;
+}
+
+namespace{
+
+torch::Tensor evalColors(const GaussianSnapshot &snapshot, const torch::Tensor &viewDirs, const torch::Tensor &shs){
+    torch::Tensor rgbs = compute_sh_forward_tensor_cpu(viewDirs.size(0), snapshot.shDegree, snapshot.degreesToUse, viewDirs, shs);
+    return torch::clamp_min(rgbs + 0.5f, 0.0f);
+}
+
+torch::Tensor cachedColors(const GaussianSnapshot &snapshot, const torch::Tensor &viewDirs, ColorCache &cache){
+    const long long numPoints = viewDirs.size(0);
+    if (cache.source != snapshot.shs.data_ptr() || !cache.rgbs.defined() || cache.rgbs.size(0) != numPoints){
+        cache.source = snapshot.shs.data_ptr();
+        cache.rgbs = evalColors(snapshot, viewDirs, snapshot.shs);
+        cache.dirs = viewDirs.clone();
+        cache.evaluated += numPoints;
+        return cache.rgbs;
+    }
+
+    // Degree 0 doesn't depend on the view direction
+    if (snapshot.degreesToUse == 0){
+        cache.reused += numPoints;
+        return cache.rgbs;
+    }
+
+    torch::Tensor stale = (cache.dirs * viewDirs).sum(-1) < std::cos(cache.tolerance);
+    torch::Tensor idcs = stale.nonzero().squeeze(-1);
+    const long long numStale = idcs.size(0);
+    if (numStale > 0){
+        torch::Tensor dirs = viewDirs.index({idcs}).contiguous();
+        cache.rgbs.index_put_({idcs}, evalColors(snapshot, dirs, snapshot.shs.index({idcs}).contiguous()));
+        cache.dirs.index_put_({idcs}, dirs);
+    }
+    cache.evaluated += numStale;
+    cache.reused += numPoints - numStale;
+    return cache.rgbs;
+}
+
+}
+
+torch::Tensor renderSnapshot(const GaussianSnapshot &snapshot, const CameraConstants &camera, ColorCache *colors){
+    torch::NoGradGuard noGrad;
+
+    const long long numPoints = snapshot.means.size(0);
+    torch::TensorOptions opts = torch::TensorOptions().dtype(torch::kFloat32);
+    torch::Tensor xys = torch::empty({numPoints, 2}, opts);
+    torch::Tensor radii = torch::empty({numPoints}, opts.dtype(torch::kInt32));
+    torch::Tensor conics = torch::empty({numPoints, 3}, opts);
+    torch::Tensor cov2d = torch::empty({numPoints, 2, 2}, opts);
+    torch::Tensor camDepths = torch::empty({numPoints}, opts);
+
+    project_gaussians_forward_fused_cpu(numPoints, snapshot.means, snapshot.scales, 1.0f, snapshot.quats,
+                                        camera.viewMat.cpu(), camera.projMat.cpu(),
+                                        camera.fx, camera.fy, camera.cx, camera.cy, camera.height, camera.width,
+                                        xys, radii, conics, cov2d, camDepths);
+
+    torch::Tensor viewDirs = snapshot.means - camera.center.cpu();
+    viewDirs = viewDirs / viewDirs.norm(2, {-1}, true);
+    const bool useCache = colors != nullptr && (snapshot.degreesToUse == 0 || colors->tolerance > 0.0f);
+    torch::Tensor rgbs = useCache ? cachedColors(snapshot, viewDirs, *colors) : evalColors(snapshot, viewDirs, snapshot.shs);
+
+    auto r = rasterize_forward_tensor_cpu(camera.width, camera.height, xys, conics, rgbs, snapshot.opacities,
+                                          snapshot.background, cov2d, camDepths, false, true);
+    delete[] std::get<2>(r);
+
+    return torch::clamp_max(std::get<0>(r), 1.0f);
+}
@@ -0,0 +1,47 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <array>
+#include <string>
+#include <torch/torch.h>
+#include "camera_bank.hpp"
+
+// Detached CPU copy of the parameters of a model, with activations
+// already applied. Can be rendered while the model keeps training.
+struct GaussianSnapshot{
+    torch::Tensor means;      // [N, 3]
+    torch::Tensor scales;     // [N, 3] exp(scales)
+    torch::Tensor quats;      // [N, 4] normalized
+    torch::Tensor shs;        // [N, numShBases(shDegree), 3]
+    torch::Tensor opacities;  // [N, 1] sigmoid(opacities)
+    torch::Tensor background; // [3]
+    int shDegree = 0;
+    int degreesToUse = 0;
+};
+
+// Reads a splat written by Model::savePlySplat. scale and translation are
+// those of the project (InputData), used to move the gaussians back into
+// the normalized space of its cameras
+GaussianSnapshot readPlySplat(const std::string &filename, float scale, const torch::Tensor &translation,
+                              const std::array<float, 3> &background);
+
+// Colors of the gaussians of a snapshot, kept by renderSnapshot across the
+// views of a sequence. A color is evaluated again only when the direction
+// from the camera to its gaussian turned by more than tolerance (radians)
+// since it was, never if the snapshot only has degree 0. With a tolerance
+// of 0 and a higher degree nothing can be reused, and renderSnapshot
+// evaluates all colors without the cache. Not thread safe
+struct ColorCache{
+    float tolerance = 0.0f;
+
+    const void *source = nullptr; // shs of the snapshot of the colors
+    torch::Tensor rgbs;           // [N, 3]
+    torch::Tensor dirs;           // [N, 3] view directions of rgbs
+    size_t reused = 0;
+    size_t evaluated = 0;
+};
+
+// Renders a snapshot on the CPU without autograd. Returns a [H, W, 3] image
+torch::Tensor renderSnapshot(const GaussianSnapshot &snapshot, const CameraConstants &camera, ColorCache *colors = nullptr);
+
+#endif
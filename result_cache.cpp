@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "result_cache.hpp"
+#include "task_scheduler.hpp"
+
+namespace fs = std::filesystem;
+
+namespace{
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t rotr(uint32_t x, int n){
+    return (x >> n) | (x << (32 - n));
+}
+
+const char *lossesFile = "losses.txt";
+const char *sceneFile = "scene.ply";
+const char *tilesDir = "tiles";
+
+}
+
+Sha256::Sha256(){
+    const uint32_t init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    std::memcpy(state, init, sizeof(state));
+}
+
+void Sha256::compress(const uint8_t *block){
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++){
+        w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) | (static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+               (static_cast<uint32_t>(block[i * 4 + 2]) << 8) | static_cast<uint32_t>(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; i++){
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++){
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Sha256::update(const void *data, size_t size){
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    totalSize += size;
+
+    if (bufferSize > 0){
+        size_t n = (std::min)(size, sizeof(buffer) - bufferSize);
+        std::memcpy(buffer + bufferSize, p, n);
+        bufferSize += n;
+        p += n;
+        size -= n;
+        if (bufferSize < sizeof(buffer)) return;
+        compress(buffer);
+        bufferSize = 0;
+    }
+    for (; size >= 64; p += 64, size -= 64) compress(p);
+    std::memcpy(buffer, p, size);
+    bufferSize = size;
+}
+
+std::string Sha256::hexDigest(){
+    const uint64_t bits = totalSize * 8;
+    const uint8_t pad = 0x80;
+    const uint8_t zero = 0;
+    update(&pad, 1);
+    while (bufferSize != 56) update(&zero, 1);
+    uint8_t len[8];
+    for (int i = 0; i < 8; i++) len[i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+    update(len, 8);
+
+    std::ostringstream ss;
+    ss << std::hex << std::setfill('0');
+    for (int i = 0; i < 8; i++) ss << std::setw(8) << state[i];
+    return ss.str();
+}
+
+std::string sha256File(const std::string &path){
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) throw std::runtime_error("Cannot open " + path);
+
+    Sha256 h;
+    std::vector<char> chunk(1 << 20);
+    while (f){
+        f.read(chunk.data(), chunk.size());
+        h.update(chunk.data(), static_cast<size_t>(f.gcount()));
+    }
+    return h.hexDigest();
+}
+
+std::string jobHash(const InputData &inputData, const std::vector<std::pair<std::string, std::string>> &options){
+    std::vector<std::string> files = inputData.sourceFiles;
+    for (const Camera &cam : inputData.cameras) files.push_back(cam.filePath);
+
+    // Files are hashed in parallel, the job hash covers their digests
+    std::vector<std::string> digests(files.size());
+    TaskScheduler::instance().parallelFor(0, files.size(), 1, [&](size_t start, size_t end){
+        for (size_t i = start; i < end; i++) digests[i] = sha256File(files[i]);
+    }, TaskPriority::Prefetch);
+
+    Sha256 h;
+    for (const std::string &d : digests) h.update(d);
+    for (const auto &kv : options){
+        h.update(kv.first);
+        h.update("=", 1);
+        h.update(kv.second);
+        h.update("\n", 1);
+    }
+    return h.hexDigest();
+}
+
+bool ResultCache::restore(const std::string &hash, const std::string &outputScene, const std::string &tilesOutput) const{
+    fs::path entry = fs::path(dir) / hash;
+    if (!fs::exists(entry / sceneFile)) return false;
+    if (!tilesOutput.empty() && !fs::exists(entry / tilesDir)) return false;
+
+    fs::copy_file(entry / sceneFile, outputScene, fs::copy_options::overwrite_existing);
+    if (fs::exists(entry / lossesFile)){
+        fs::copy_file(entry / lossesFile, fs::path(outputScene).parent_path() / lossesFile, fs::copy_options::overwrite_existing);
+    }
+    if (!tilesOutput.empty()){
+        fs::create_directories(tilesOutput);
+        fs::copy(entry / tilesDir, tilesOutput, fs::copy_options::recursive | fs::copy_options::overwrite_existing);
+    }
+    return true;
+}
+
+void ResultCache::store(const std::string &hash, const std::string &outputScene, const std::string &tilesOutput) const{
+    fs::path entry = fs::path(dir) / hash;
+    fs::path tmp = fs::path(dir) / (hash + ".tmp" + std::to_string(std::hash<std::string>{}(outputScene)));
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+
+    fs::copy_file(outputScene, tmp / sceneFile);
+    fs::path losses = fs::path(outputScene).parent_path() / lossesFile;
+    if (fs::exists(losses)) fs::copy_file(losses, tmp / lossesFile);
+    if (!tilesOutput.empty()) fs::copy(tilesOutput, tmp / tilesDir, fs::copy_options::recursive);
+
+    // Another job may have stored the same entry in the meantime
+    std::error_code ec;
+    if (!fs::exists(entry)) fs::rename(tmp, entry, ec);
+    if (fs::exists(tmp)) fs::remove_all(tmp);
+}
@@ -0,0 +1,47 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "input_data.hpp"
+
+class Sha256{
+public:
+    Sha256();
+    void update(const void *data, size_t size);
+    void update(const std::string &s){ update(s.data(), s.size()); }
+    std::string hexDigest();
+private:
+    void compress(const uint8_t *block);
+
+    uint32_t state[8];
+    uint8_t buffer[64];
+    size_t bufferSize = 0;
+    uint64_t totalSize = 0;
+};
+
+std::string sha256File(const std::string &path);
+
+// Hash of everything a training job reads: the project files, the bytes of
+// all images and the given (name, value) options, in order
+std::string jobHash(const InputData &inputData, const std::vector<std::pair<std::string, std::string>> &options);
+
+// Outputs of past jobs, stored by job hash in dir/<hash>/
+class ResultCache{
+public:
+    ResultCache(const std::string &dir) : dir(dir) {};
+
+    // Copies the stored outputs of a job to outputScene (and its losses.txt)
+    // and tilesOutput (if not empty). Returns false if they are not all stored
+    bool restore(const std::string &hash, const std::string &outputScene, const std::string &tilesOutput) const;
+
+    // Stores the outputs of a job. Entries are renamed into place once
+    // complete, so concurrent jobs never see partial ones
+    void store(const std::string &hash, const std::string &outputScene, const std::string &tilesOutput) const;
+private:
+    std::string dir;
+};
+
+#endif
@@ -158,7 +158,8 @@ int main(int argc, char **argv){
                 p[4], // camDepths
                 height,
                 width,
-                background);
+                background,
+                nullptr);
         }else{
             #if defined(USE_HIP) || defined(USE_CUDA)
                 auto p = ProjectGaussians::apply(means, scales, 1, 
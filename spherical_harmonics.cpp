@@ -70,4 +70,11 @@ torch::Tensor SphericalHarmonicsCPU::apply(int degreesToUse,
     int degree = degFromSh(coeffs.size(-2)); 
 
     return compute_sh_forward_tensor_cpu(numPoints, degree, degreesToUse, viewDirs, coeffs);
+}
+
+torch::Tensor SphericalHarmonicsCPU::apply(int degreesToUse, 
+            torch::Tensor viewDirs, 
+            torch::Tensor dc,
+            torch::Tensor rest){
+    return compute_sh_forward_split_tensor_cpu(degreesToUse, viewDirs, dc, rest);
 }
\ No newline at end of file
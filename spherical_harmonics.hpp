@@ -28,6 +28,13 @@ public:
     static torch::Tensor apply(int degreesToUse, 
             torch::Tensor viewDirs, 
             torch::Tensor coeffs);
+
+    // Degree 0 coefficients [N, 3] and the others [N, bases - 1, 3],
+    // which can be stored in half precision
+    static torch::Tensor apply(int degreesToUse, 
+            torch::Tensor viewDirs, 
+            torch::Tensor dc,
+            torch::Tensor rest);
 };
 
 #endif
\ No newline at end of file
@@ -5,21 +5,38 @@
 
 using namespace torch::indexing;
 
-torch::Tensor SSIM::eval(const torch::Tensor& rendered, const torch::Tensor& gt) {
-    torch::Tensor img1 = gt.permute({2, 0, 1}).index({None, "..."});
-    torch::Tensor img2 = rendered.permute({2, 0, 1}).index({None, "..."});
+SsimMoments SSIM::moments(const torch::Tensor& gt){
+    torch::NoGradGuard noGrad;
 
+    torch::Tensor img1 = gt.permute({2, 0, 1}).index({None, "..."});
     if (img1.device() != window.device()){
         window = window.to(img1.device());
     }
-    torch::Tensor mu1 = torch::nn::functional::conv2d(img1, window, torch::nn::functional::Conv2dFuncOptions().padding(windowSize / 2).groups(channel));
+    auto convOpts = torch::nn::functional::Conv2dFuncOptions().padding(windowSize / 2).groups(channel);
+
+    SsimMoments m;
+    m.image = img1;
+    m.mu = torch::nn::functional::conv2d(img1, window, convOpts);
+    m.sigmaSq = torch::nn::functional::conv2d(img1 * img1, window, convOpts) - m.mu.pow(2);
+    return m;
+}
+
+torch::Tensor SSIM::eval(const torch::Tensor& rendered, const torch::Tensor& gt, const SsimMoments *gtMoments) {
+    torch::Tensor img2 = rendered.permute({2, 0, 1}).index({None, "..."});
+
+    if (img2.device() != window.device()){
+        window = window.to(img2.device());
+    }
+    SsimMoments m1 = gtMoments != nullptr ? *gtMoments : moments(gt);
+    torch::Tensor img1 = m1.image;
+    torch::Tensor mu1 = m1.mu;
     torch::Tensor mu2 = torch::nn::functional::conv2d(img2, window, torch::nn::functional::Conv2dFuncOptions().padding(windowSize / 2).groups(channel));
 
     torch::Tensor mu1Sq = mu1.pow(2);
     torch::Tensor mu2Sq = mu2.pow(2);
     torch::Tensor mu1mu2 = mu1 * mu2;
 
-    torch::Tensor sigma1Sq = torch::nn::functional::conv2d(img1 * img1, window, torch::nn::functional::Conv2dFuncOptions().padding(windowSize / 2).groups(channel)) - mu1Sq;
+    torch::Tensor sigma1Sq = m1.sigmaSq;
     torch::Tensor sigma2Sq = torch::nn::functional::conv2d(img2 * img2, window, torch::nn::functional::Conv2dFuncOptions().padding(windowSize / 2).groups(channel)) - mu2Sq;
     torch::Tensor sigma12 = torch::nn::functional::conv2d(img1 * img2, window, torch::nn::functional::Conv2dFuncOptions().padding(windowSize / 2).groups(channel)) - mu1mu2;
     
@@ -31,6 +48,55 @@ torch::Tensor SSIM::eval(const torch::Tensor& rendered, const torch::Tensor& gt)
     return ssimMap.mean();
 }
 
+std::tuple<torch::Tensor, torch::Tensor> SSIM::evalBackward(const torch::Tensor& rendered, const torch::Tensor& gt, float dLdSsim,
+                                                            const SsimMoments *gtMoments){
+    torch::NoGradGuard noGrad;
+
+    torch::Tensor img2 = rendered.permute({2, 0, 1}).index({None, "..."});
+
+    if (img2.device() != window.device()){
+        window = window.to(img2.device());
+    }
+    auto convOpts = torch::nn::functional::Conv2dFuncOptions().padding(windowSize / 2).groups(channel);
+    auto convTOpts = torch::nn::functional::ConvTranspose2dFuncOptions().padding(windowSize / 2).groups(channel);
+
+    SsimMoments m1 = gtMoments != nullptr ? *gtMoments : moments(gt);
+    torch::Tensor img1 = m1.image;
+    torch::Tensor mu1 = m1.mu;
+    torch::Tensor mu2 = torch::nn::functional::conv2d(img2, window, convOpts);
+
+    torch::Tensor mu1Sq = mu1.pow(2);
+    torch::Tensor mu2Sq = mu2.pow(2);
+    torch::Tensor mu1mu2 = mu1 * mu2;
+
+    torch::Tensor sigma1Sq = m1.sigmaSq;
+    torch::Tensor sigma2Sq = torch::nn::functional::conv2d(img2 * img2, window, convOpts) - mu2Sq;
+    torch::Tensor sigma12 = torch::nn::functional::conv2d(img1 * img2, window, convOpts) - mu1mu2;
+
+    const float C1 = 0.01 * 0.01;
+    const float C2 = 0.03 * 0.03;
+
+    torch::Tensor a1 = 2.0f * mu1mu2 + C1;
+    torch::Tensor a2 = 2.0f * sigma12 + C2;
+    torch::Tensor b1 = mu1Sq + mu2Sq + C1;
+    torch::Tensor b2 = sigma1Sq + sigma2Sq + C2;
+    torch::Tensor b1b2 = b1 * b2;
+    torch::Tensor ssimMap = (a1 * a2) / b1b2;
+
+    // Gradients of the map w.r.t. mu2, E[img2^2] and E[img1 img2]
+    const float d = dLdSsim / static_cast<float>(ssimMap.numel());
+    torch::Tensor gMu2 = d * (2.0f * mu1 * (a2 - a1) / b1b2 - 2.0f * mu2 * ssimMap * (1.0f / b1 - 1.0f / b2));
+    torch::Tensor gE22 = -d * ssimMap / b2;
+    torch::Tensor gE12 = d * 2.0f * a1 / b1b2;
+
+    // Adjoint of the window convolution
+    torch::Tensor grad = torch::nn::functional::conv_transpose2d(gMu2, window, convTOpts) +
+                         2.0f * img2 * torch::nn::functional::conv_transpose2d(gE22, window, convTOpts) +
+                         img1 * torch::nn::functional::conv_transpose2d(gE12, window, convTOpts);
+
+    return std::make_tuple(ssimMap.mean(), grad.squeeze(0).permute({1, 2, 0}));
+}
+
 torch::Tensor SSIM::createWindow(){
     torch::Tensor _1DWindow = gaussian(1.5f).unsqueeze(1);
     torch::Tensor _2DWindow = _1DWindow.mm(_1DWindow.t()).unsqueeze(0).unsqueeze(0);
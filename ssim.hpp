@@ -6,13 +6,33 @@
 // Ported from https://github.com/Po-Hsun-Su/pytorch-ssim
 // MIT
 
+// Local mean and variance of an image over the SSIM window, [1, C, H, W],
+// along with the image they were computed from
+struct SsimMoments{
+    torch::Tensor image;
+    torch::Tensor mu;
+    torch::Tensor sigmaSq;
+
+    size_t bytes() const { return mu.nbytes() + sigmaSq.nbytes(); }
+};
+
 class SSIM{
 public:
     SSIM(int windowSize, int channel) : windowSize(windowSize), channel(channel){
         window = createWindow();
     };
 
-    torch::Tensor eval(const torch::Tensor& rendered, const torch::Tensor& gt);
+    // Moments of a ground truth image, which can be kept and passed to
+    // eval and evalBackward to skip two of their five convolutions. gt is
+    // then not read and can be left undefined
+    SsimMoments moments(const torch::Tensor& gt);
+
+    torch::Tensor eval(const torch::Tensor& rendered, const torch::Tensor& gt, const SsimMoments *gtMoments = nullptr);
+
+    // Computes SSIM and its gradient w.r.t. rendered without autograd,
+    // with dLdSsim being the derivative of the loss w.r.t. the SSIM value
+    std::tuple<torch::Tensor, torch::Tensor> evalBackward(const torch::Tensor& rendered, const torch::Tensor& gt, float dLdSsim,
+                                                          const SsimMoments *gtMoments = nullptr);
 private:
     torch::Tensor createWindow();
     torch::Tensor gaussian(float sigma);
@@ -0,0 +1,231 @@
+#include "task_scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ATen/Parallel.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static thread_local int workerIndex = -1;
+static thread_local TaskPriority runningPriority = TaskPriority::Training;
+
+TaskScheduler &TaskScheduler::instance(){
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+int TaskScheduler::currentWorker(){
+    return workerIndex;
+}
+
+TaskPriority TaskScheduler::currentPriority(){
+    return runningPriority;
+}
+
+void TaskScheduler::configure(int numWorkers, bool pinThreads){
+    stop();
+
+    unsigned int hw = (std::max)(std::thread::hardware_concurrency(), 1u);
+    if (numWorkers <= 0) numWorkers = static_cast<int>(hw);
+
+    running = true;
+    for (int i = 0; i < numWorkers; i++){
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < numWorkers; i++){
+        workers[i]->thread = std::thread(&TaskScheduler::workerLoop, this, i);
+
+        if (pinThreads){
+        #ifdef __linux__
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(i % hw, &cpuset);
+            pthread_setaffinity_np(workers[i]->thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+        #endif
+        }
+    }
+}
+
+void TaskScheduler::stop(){
+    if (workers.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running = false;
+    }
+    wakeUp.notify_all();
+
+    // Workers drain the queues before exiting
+    for (auto &w : workers){
+        if (w->thread.joinable()) w->thread.join();
+    }
+    workers.clear();
+}
+
+TaskScheduler::~TaskScheduler(){
+    stop();
+}
+
+void TaskScheduler::submit(TaskPriority priority, std::function<void()> fn, TaskGroup *group){
+    Task task{ std::move(fn), group, priority };
+    if (group) group->pending++;
+
+    if (workers.empty()){
+        runTask(task);
+        return;
+    }
+
+    int self = currentWorker();
+    size_t q = self >= 0 ? static_cast<size_t>(self) : (nextQueue++ % workers.size());
+    {
+        std::lock_guard<std::mutex> lock(workers[q]->mutex);
+        workers[q]->queues[static_cast<int>(priority)].push_back(std::move(task));
+    }
+    queued++;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_one();
+}
+
+bool TaskScheduler::popTask(int self, int maxPriority, Task &task){
+    const int n = static_cast<int>(workers.size());
+
+    for (int p = 0; p <= maxPriority; p++){
+        // Own queue first (LIFO, cache-warm)
+        if (self >= 0){
+            Worker &w = *workers[self];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (!w.queues[p].empty()){
+                task = std::move(w.queues[p].back());
+                w.queues[p].pop_back();
+                queued--;
+                return true;
+            }
+        }
+
+        // Steal from the others (FIFO)
+        for (int k = 1; k <= n; k++){
+            int victim = ((self >= 0 ? self : 0) + k) % n;
+            if (victim == self) continue;
+
+            Worker &w = *workers[victim];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (!w.queues[p].empty()){
+                task = std::move(w.queues[p].front());
+                w.queues[p].pop_front();
+                queued--;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool TaskScheduler::tryRunOne(int self, int maxPriority){
+    if (queued.load() == 0) return false;
+
+    Task task;
+    if (!popTask(self, maxPriority, task)) return false;
+    runTask(task);
+    return true;
+}
+
+void TaskScheduler::runTask(Task &task){
+    TaskGroup *group = task.group;
+
+    // Tasks can run nested in others, through wait()
+    const TaskPriority outer = runningPriority;
+    runningPriority = task.priority;
+    try{
+        if (!(group && group->cancelled.load())) task.fn();
+    }catch(...){
+        if (group){
+            std::lock_guard<std::mutex> lock(group->errorMutex);
+            if (!group->error) group->error = std::current_exception();
+        }
+    }
+    runningPriority = outer;
+
+    // Don't touch the group after the last decrement, the waiter might destroy it
+    if (group && --group->pending == 0){
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        groupDone.notify_all();
+    }
+}
+
+// Tensor ops of tasks run serially on their worker, the cores are already
+// taken by the other workers. libtorch's intra-op pool is left to the threads
+// outside of the scheduler. The OpenMP backend keeps its thread count per
+// thread; with the native backend, tasks still share the one intra-op pool
+static void serialTorchOps(){
+    at::internal::lazy_init_num_threads();
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+}
+
+void TaskScheduler::workerLoop(int id){
+    workerIndex = id;
+    serialTorchOps();
+
+    while (true){
+        if (tryRunOne(id, NUM_TASK_PRIORITIES - 1)) continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        if (!running && queued.load() == 0) break;
+        wakeUp.wait(lock, [this]{ return queued.load() > 0 || !running; });
+    }
+}
+
+void TaskScheduler::wait(TaskGroup &group){
+    int self = currentWorker();
+    int maxPriority = static_cast<int>(group.priority);
+
+    while (!group.done()){
+        if (tryRunOne(self, maxPriority)) continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        groupDone.wait_for(lock, std::chrono::milliseconds(1), [&group]{ return group.done(); });
+    }
+
+    std::lock_guard<std::mutex> lock(group.errorMutex);
+    if (group.error){
+        std::exception_ptr e = group.error;
+        group.error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void TaskScheduler::parallelFor(size_t start, size_t stop, size_t grain,
+                                const std::function<void(size_t, size_t)> &fn,
+                                TaskPriority priority){
+    if (stop <= start) return;
+
+    size_t n = stop - start;
+    grain = (std::max)(grain, static_cast<size_t>(1));
+    size_t maxChunks = static_cast<size_t>(numWorkers() + 1) * 4;
+    size_t numChunks = (std::min)((n + grain - 1) / grain, maxChunks);
+
+    if (workers.empty() || numChunks <= 1){
+        fn(start, stop);
+        return;
+    }
+
+    size_t chunk = (n + numChunks - 1) / numChunks;
+    TaskGroup group(priority);
+    for (size_t b = start; b < stop; b += chunk){
+        size_t e = (std::min)(b + chunk, stop);
+        submit(priority, [&fn, b, e](){ fn(b, e); }, &group);
+    }
+    wait(group);
+}
@@ -0,0 +1,98 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Lower values run first
+enum class TaskPriority { Training = 0, Prefetch = 1, SnapshotIO = 2 };
+const int NUM_TASK_PRIORITIES = 3;
+
+// Tracks completion of a set of tasks submitted to the scheduler
+class TaskGroup{
+public:
+    TaskGroup(TaskPriority priority = TaskPriority::Training) : priority(priority) {};
+    bool done() const { return pending.load() == 0; }
+    // Tasks of the group that haven't started yet are dropped
+    void cancel() { cancelled = true; }
+private:
+    friend class TaskScheduler;
+    TaskPriority priority;
+    std::atomic<int> pending{0};
+    std::atomic<bool> cancelled{false};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+// Work-stealing scheduler shared by the CPU kernels, the image
+// pipeline and background writers. Each worker owns one deque per priority;
+// idle workers steal from the others, always preferring higher priority work.
+class TaskScheduler{
+public:
+    static TaskScheduler &instance();
+
+    // Restarts the workers. numWorkers <= 0 uses all hardware threads;
+    // pinThreads sets the core affinity of worker i to core i (Linux only)
+    void configure(int numWorkers, bool pinThreads = false);
+    int numWorkers() const { return static_cast<int>(workers.size()); }
+
+    void submit(TaskPriority priority, std::function<void()> fn, TaskGroup *group = nullptr);
+
+    // Blocks until all tasks of the group are done. The calling thread helps
+    // by running tasks that have at least the priority of the group.
+    // Rethrows the first exception raised by a task of the group.
+    void wait(TaskGroup &group);
+
+    // Runs fn(begin, end) over chunks of [start, stop) of at least grain items
+    // and waits for all of them. By default the chunks get the priority of
+    // the calling task, so that a kernel run by a background task stays
+    // in the background
+    void parallelFor(size_t start, size_t stop, size_t grain,
+                     const std::function<void(size_t, size_t)> &fn,
+                     TaskPriority priority = currentPriority());
+
+    // Index of the calling worker thread in [0, numWorkers()), or -1
+    static int currentWorker();
+    // Priority of the task running on the calling thread, Training outside of tasks
+    static TaskPriority currentPriority();
+
+    ~TaskScheduler();
+private:
+    TaskScheduler() {};
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler &operator=(const TaskScheduler&) = delete;
+
+    struct Task{
+        std::function<void()> fn;
+        TaskGroup *group;
+        TaskPriority priority;
+    };
+    struct Worker{
+        std::mutex mutex;
+        std::deque<Task> queues[NUM_TASK_PRIORITIES];
+        std::thread thread;
+    };
+
+    void stop();
+    void workerLoop(int id);
+    bool tryRunOne(int self, int maxPriority);
+    bool popTask(int self, int maxPriority, Task &task);
+    void runTask(Task &task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> running{false};
+    std::atomic<int> queued{0};
+    std::atomic<unsigned int> nextQueue{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::condition_variable groupDone;
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include "tile_export.hpp"
+#include "task_scheduler.hpp"
+#include "vendor/json/json.hpp"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+using namespace torch::indexing;
+
+namespace{
+
+const float SH_C0 = 0.28209479177387814f;
+
+struct OctreeNode{
+    std::array<float, 3> min;
+    std::array<float, 3> max;
+    int depth = 0;
+    int parent = -1;
+    std::vector<int> children;
+    std::vector<int32_t> ids;
+
+    float maxScale = 0.0f; // largest scale of the gaussians of the node
+    float error = 0.0f;    // largest scale of the gaussians of its descendants
+    float scaleRange[2] = {0.0f, 0.0f};
+    float shRange[2] = {0.0f, 0.0f};
+};
+
+inline uint8_t quantize8(float v, float lo, float hi){
+    float t = hi > lo ? (v - lo) / (hi - lo) : 0.0f;
+    return static_cast<uint8_t>(std::lround((std::min)((std::max)(t, 0.0f), 1.0f) * 255.0f));
+}
+
+inline uint16_t quantize16(float v, float lo, float hi){
+    float t = hi > lo ? (v - lo) / (hi - lo) : 0.0f;
+    return static_cast<uint16_t>(std::lround((std::min)((std::max)(t, 0.0f), 1.0f) * 65535.0f));
+}
+
+std::vector<OctreeNode> buildOctree(const float *means, const float *importance, int64_t numPoints, int nodeSize, int maxDepth){
+    std::vector<OctreeNode> nodes(1);
+    std::vector<std::vector<int32_t>> pending(1);
+
+    // Root is the bounding cube of all gaussians
+    std::array<float, 3> lo = { INFINITY, INFINITY, INFINITY };
+    std::array<float, 3> hi = { -INFINITY, -INFINITY, -INFINITY };
+    for (int64_t i = 0; i < numPoints; i++){
+        for (int k = 0; k < 3; k++){
+            lo[k] = (std::min)(lo[k], means[i * 3 + k]);
+            hi[k] = (std::max)(hi[k], means[i * 3 + k]);
+        }
+    }
+    float halfSize = 0.0f;
+    for (int k = 0; k < 3; k++) halfSize = (std::max)(halfSize, 0.5f * (hi[k] - lo[k]));
+    halfSize = halfSize * 1.001f + 1e-6f;
+    for (int k = 0; k < 3; k++){
+        float c = 0.5f * (lo[k] + hi[k]);
+        nodes[0].min[k] = c - halfSize;
+        nodes[0].max[k] = c + halfSize;
+    }
+    pending[0].resize(numPoints);
+    std::iota(pending[0].begin(), pending[0].end(), 0);
+
+    // Breadth first, nodes is appended to while iterating
+    for (size_t n = 0; n < nodes.size(); n++){
+        std::vector<int32_t> ids = std::move(pending[n]);
+        if (static_cast<int>(ids.size()) <= nodeSize || nodes[n].depth >= maxDepth){
+            nodes[n].ids = std::move(ids);
+            continue;
+        }
+
+        // The most important gaussians stay here, the others go to the children
+        std::nth_element(ids.begin(), ids.begin() + nodeSize, ids.end(), [importance](int32_t a, int32_t b){
+            return importance[a] > importance[b];
+        });
+        nodes[n].ids.assign(ids.begin(), ids.begin() + nodeSize);
+
+        std::array<float, 3> center;
+        for (int k = 0; k < 3; k++) center[k] = 0.5f * (nodes[n].min[k] + nodes[n].max[k]);
+
+        std::array<std::vector<int32_t>, 8> octants;
+        for (auto it = ids.begin() + nodeSize; it != ids.end(); it++){
+            const float *p = means + static_cast<size_t>(*it) * 3;
+            int o = (p[0] >= center[0] ? 1 : 0) | (p[1] >= center[1] ? 2 : 0) | (p[2] >= center[2] ? 4 : 0);
+            octants[o].push_back(*it);
+        }
+
+        for (int o = 0; o < 8; o++){
+            if (octants[o].empty()) continue;
+
+            OctreeNode child;
+            for (int k = 0; k < 3; k++){
+                bool upper = (o >> k) & 1;
+                child.min[k] = upper ? center[k] : nodes[n].min[k];
+                child.max[k] = upper ? nodes[n].max[k] : center[k];
+            }
+            child.depth = nodes[n].depth + 1;
+            child.parent = static_cast<int>(n);
+
+            nodes[n].children.push_back(static_cast<int>(nodes.size()));
+            nodes.push_back(child);
+            pending.push_back(std::move(octants[o]));
+        }
+    }
+
+    return nodes;
+}
+
+}
+
+void writeSplatTiles(const GaussianSnapshot &snapshot, float scale, const torch::Tensor &translation,
+                     const std::string &outputDir, int nodeSize, int maxDepth){
+    torch::NoGradGuard noGrad;
+    if (nodeSize <= 0) throw std::runtime_error("nodeSize must be positive");
+
+    const int64_t numPoints = snapshot.means.size(0);
+    const int64_t numRest = snapshot.shs.size(1) - 1;
+
+    // Same space as savePlySplat
+    torch::Tensor means = ((snapshot.means / scale) + translation.cpu()).contiguous();
+    torch::Tensor logScales = (torch::log(snapshot.scales) - std::log(scale)).contiguous();
+    torch::Tensor quats = torch::where(snapshot.quats.index({Slice(), Slice(0, 1)}) < 0.0f, -snapshot.quats, snapshot.quats).contiguous();
+    torch::Tensor colors = torch::clamp(snapshot.shs.index({Slice(), 0, Slice()}) * SH_C0 + 0.5f, 0.0f, 1.0f).contiguous();
+    torch::Tensor rest = snapshot.shs.index({Slice(), Slice(1, None), Slice()}).contiguous();
+    torch::Tensor opacities = snapshot.opacities.contiguous();
+
+    // Opacity x area of the two largest axes
+    torch::Tensor sortedScales = std::get<0>(torch::sort(snapshot.scales, -1, true));
+    torch::Tensor importance = (opacities.index({Slice(), 0}) *
+                                sortedScales.index({Slice(), 0}) * sortedScales.index({Slice(), 1})).contiguous();
+    torch::Tensor maxScales = (sortedScales.index({Slice(), 0}) / scale).contiguous();
+
+    const float *pMeans = static_cast<const float *>(means.data_ptr());
+    const float *pLogScales = static_cast<const float *>(logScales.data_ptr());
+    const float *pQuats = static_cast<const float *>(quats.data_ptr());
+    const float *pColors = static_cast<const float *>(colors.data_ptr());
+    const float *pRest = static_cast<const float *>(rest.data_ptr());
+    const float *pOpacities = static_cast<const float *>(opacities.data_ptr());
+    const float *pMaxScales = static_cast<const float *>(maxScales.data_ptr());
+
+    std::vector<OctreeNode> nodes = buildOctree(pMeans, static_cast<const float *>(importance.data_ptr()), numPoints, nodeSize, maxDepth);
+
+    if (!fs::exists(outputDir)) fs::create_directories(outputDir);
+
+    // Each node is encoded and written independently
+    TaskScheduler::instance().parallelFor(0, nodes.size(), 1, [&](size_t start, size_t end){
+        for (size_t n = start; n < end; n++){
+            OctreeNode &node = nodes[n];
+            const size_t count = node.ids.size();
+
+            float scaleLo = INFINITY, scaleHi = -INFINITY, shLo = INFINITY, shHi = -INFINITY;
+            for (int32_t id : node.ids){
+                for (int k = 0; k < 3; k++){
+                    scaleLo = (std::min)(scaleLo, pLogScales[id * 3 + k]);
+                    scaleHi = (std::max)(scaleHi, pLogScales[id * 3 + k]);
+                }
+                for (int64_t k = 0; k < numRest * 3; k++){
+                    shLo = (std::min)(shLo, pRest[id * numRest * 3 + k]);
+                    shHi = (std::max)(shHi, pRest[id * numRest * 3 + k]);
+                }
+                node.maxScale = (std::max)(node.maxScale, pMaxScales[id]);
+            }
+            if (numRest == 0) shLo = shHi = 0.0f;
+            node.scaleRange[0] = scaleLo;
+            node.scaleRange[1] = scaleHi;
+            node.shRange[0] = shLo;
+            node.shRange[1] = shHi;
+
+            std::vector<uint16_t> positions(count * 3);
+            std::vector<uint8_t> scales(count * 3);
+            std::vector<uint8_t> rotations(count * 4);
+            std::vector<uint8_t> rgba(count * 4);
+            std::vector<uint8_t> shs(count * numRest * 3);
+
+            for (size_t i = 0; i < count; i++){
+                const int32_t id = node.ids[i];
+                for (int k = 0; k < 3; k++){
+                    positions[i * 3 + k] = quantize16(pMeans[id * 3 + k], node.min[k], node.max[k]);
+                    scales[i * 3 + k] = quantize8(pLogScales[id * 3 + k], scaleLo, scaleHi);
+                    rgba[i * 4 + k] = quantize8(pColors[id * 3 + k], 0.0f, 1.0f);
+                }
+                for (int k = 0; k < 4; k++) rotations[i * 4 + k] = quantize8(pQuats[id * 4 + k], -1.0f, 1.0f);
+                rgba[i * 4 + 3] = quantize8(pOpacities[id], 0.0f, 1.0f);
+                for (int64_t k = 0; k < numRest * 3; k++){
+                    shs[i * numRest * 3 + k] = quantize8(pRest[id * numRest * 3 + k], shLo, shHi);
+                }
+            }
+
+            std::string filename = (fs::path(outputDir) / (std::to_string(n) + ".bin")).string();
+            std::ofstream o(filename, std::ios::binary);
+            if (!o.is_open()) throw std::runtime_error("Cannot write " + filename);
+            o.write(reinterpret_cast<const char *>(positions.data()), positions.size() * sizeof(uint16_t));
+            o.write(reinterpret_cast<const char *>(scales.data()), scales.size());
+            o.write(reinterpret_cast<const char *>(rotations.data()), rotations.size());
+            o.write(reinterpret_cast<const char *>(rgba.data()), rgba.size());
+            o.write(reinterpret_cast<const char *>(shs.data()), shs.size());
+        }
+    });
+
+    // Children come after their parent
+    for (size_t n = nodes.size(); n-- > 1;){
+        OctreeNode &parent = nodes[nodes[n].parent];
+        parent.error = (std::max)(parent.error, (std::max)(nodes[n].maxScale, nodes[n].error));
+    }
+
+    json j;
+    j["version"] = 1;
+    j["count"] = numPoints;
+    j["shDegree"] = snapshot.shDegree;
+    j["nodes"] = json::array();
+    for (size_t n = 0; n < nodes.size(); n++){
+        const OctreeNode &node = nodes[n];
+        j["nodes"].push_back({
+            {"file", std::to_string(n) + ".bin"},
+            {"count", node.ids.size()},
+            {"depth", node.depth},
+            {"parent", node.parent},
+            {"children", node.children},
+            {"min", node.min},
+            {"max", node.max},
+            {"error", node.error},
+            {"scaleRange", { node.scaleRange[0], node.scaleRange[1] }},
+            {"shRange", { node.shRange[0], node.shRange[1] }}
+        });
+    }
+
+    std::string indexFile = (fs::path(outputDir) / "index.json").string();
+    std::ofstream o(indexFile);
+    o << j.dump() << std::endl;
+    std::cout << "Wrote " << nodes.size() << " tiles to " << outputDir << std::endl;
+}
@@ -0,0 +1,27 @@
+#ifndef TILE_EXPORT_H
+#define TILE_EXPORT_H
+
+#include <string>
+#include <torch/torch.h>
+#include "renderer.hpp"
+
+// Writes a splat as an octree of quantized chunks that viewers can stream
+// coarse to fine. Each node keeps the nodeSize most important gaussians
+// (opacity x area) of its cube and hands the others down to its children.
+// Nodes are numbered breadth first, so coarser nodes come first.
+//
+// outputDir receives index.json (bounds, children and error of each node, plus
+// the ranges needed to dequantize its chunk) and one <node>.bin per node,
+// made of consecutive arrays over the count gaussians of the node:
+//   uint16 x 3   position within the node bounds
+//   uint8 x 3    log scales within scaleRange
+//   uint8 x 4    rotation (w, x, y, z) from [-1, 1], with w >= 0
+//   uint8 x 4    base color (from the DC coefficients) and opacity, from [0, 1]
+//   uint8 x 3K   higher order SH coefficients ([K, 3]) within shRange
+// The error of a node is the largest scale among the gaussians of its
+// descendants, i.e. the detail that is missing when stopping at that node.
+// scale and translation are those of the project, as in savePlySplat.
+void writeSplatTiles(const GaussianSnapshot &snapshot, float scale, const torch::Tensor &translation,
+                     const std::string &outputDir, int nodeSize = 16384, int maxDepth = 16);
+
+#endif
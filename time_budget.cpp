@@ -0,0 +1,101 @@
+#include "time_budget.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+TimeBudget::TimeBudget(double seconds, int maxSteps, int numDownscales, int resolutionSchedule, int warmupLength,
+                       std::chrono::steady_clock::time_point start) :
+    seconds(seconds), maxSteps(maxSteps), numDownscales((std::max)(numDownscales, 0)),
+    resolutionSchedule(resolutionSchedule), warmupLength(warmupLength), start(start), projected(maxSteps) {}
+
+double TimeBudget::elapsed() const{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool TimeBudget::update(int step, double stepTime, size_t pixels, int downscaleFactor){
+    stepEma = samples == 0 ? stepTime : stepEma + 0.05 * (stepTime - stepEma);
+    fullPixels = static_cast<double>(pixels) * downscaleFactor * downscaleFactor;
+    samples++;
+
+    // The first steps pay for lazy initializations
+    if (samples <= 2) return false;
+
+    const double decay = 0.99;
+    const double x = static_cast<double>(pixels);
+    sw = sw * decay + 1.0;
+    sx = sx * decay + x;
+    sy = sy * decay + stepTime;
+    sxx = sxx * decay + x * x;
+    sxy = sxy * decay + x * stepTime;
+
+    const int reprojectEvery = 25;
+    if (samples < 10 || step % reprojectEvery != 0) return false;
+
+    // Largest number of steps whose remaining ones fit in the time left
+    const double left = seconds - elapsed();
+    int lo = step, hi = projected;
+    while (lo < hi){
+        int mid = lo + (hi - lo + 1) / 2;
+        if (costOf(step, mid) <= left) lo = mid;
+        else hi = mid - 1;
+    }
+
+    bool changed = lo != projected;
+    projected = lo;
+    if (baseline == 0 && step >= warmupLength) baseline = projected;
+    return changed;
+}
+
+double TimeBudget::stepCost(double pixels) const{
+    if (sw <= 0.0) return stepEma;
+
+    // Least squares fit of a + b * pixels, if the recent steps rendered
+    // different resolutions. Otherwise steps are assumed to cost the same
+    const double mean = sx / sw;
+    const double var = sxx / sw - mean * mean;
+    double a = sy / sw, b = 0.0;
+    if (var > 0.01 * mean * mean){
+        b = (sw * sxy - sx * sy) / (sw * sxx - sx * sx);
+        a = (sy - b * sx) / sw;
+        if (b < 0.0){
+            b = 0.0;
+            a = sy / sw;
+        }else if (a < 0.0){
+            a = 0.0;
+            b = sy / sx;
+        }
+    }
+    return a + b * pixels;
+}
+
+double TimeBudget::costOf(int fromStep, int numSteps) const{
+    // Same rounding as Model::setScheduleScale
+    const int schedule = (std::max)(static_cast<int>(std::lround(resolutionSchedule * static_cast<double>(numSteps) / maxSteps)), 1);
+
+    double cost = 0.0;
+    for (int q = 0; q <= numDownscales; q++){
+        long long lo = (std::max)(static_cast<long long>(q) * schedule, static_cast<long long>(fromStep) + 1);
+        long long hi = q == numDownscales ? LLONG_MAX : (static_cast<long long>(q) + 1) * schedule - 1;
+        hi = (std::min)(hi, static_cast<long long>(numSteps));
+        if (hi < lo) continue;
+
+        const double pixels = fullPixels / std::pow(4.0, numDownscales - q);
+        cost += (hi - lo + 1) * stepCost(pixels);
+    }
+    return cost;
+}
+
+double TimeBudget::reserve(long long numGaussians) const{
+    // A safety margin, the step in flight and the work after training
+    return 5.0 + (2.0 + finalRenders) * stepEma + finalPerGaussian * static_cast<double>(numGaussians);
+}
+
+void TimeBudget::reserveAfterTraining(int renders, double secondsPerGaussian){
+    finalRenders += renders;
+    finalPerGaussian += secondsPerGaussian;
+}
+
+bool TimeBudget::exhausted(long long numGaussians) const{
+    return elapsed() + reserve(numGaussians) >= seconds;
+}
@@ -0,0 +1,61 @@
+#ifndef TIME_BUDGET_H
+#define TIME_BUDGET_H
+
+#include <chrono>
+#include <cstddef>
+
+// Fits training in a wall-clock budget. Step time is modeled as a fixed cost
+// plus a cost per rendered pixel (fitted over the recent steps), so that the
+// projected number of steps accounts for the resolution schedule. The
+// projection never exceeds maxSteps and never increases, so the schedules
+// scaled to it only move forward.
+class TimeBudget{
+public:
+    TimeBudget(double seconds, int maxSteps, int numDownscales, int resolutionSchedule, int warmupLength,
+               std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now());
+
+    // Records a step that took stepTime seconds to render pixels pixels at
+    // downscaleFactor. Returns true when the projection changed
+    bool update(int step, double stepTime, size_t pixels, int downscaleFactor);
+
+    int projectedSteps() const { return projected; }
+
+    // Growth is capped once the projection fell below half of the one made
+    // at the end of the warmup, i.e. when new gaussians have eaten half of the steps
+    bool growthCapped() const { return baseline > 0 && projected < baseline / 2; }
+
+    // True when the time left is needed to write a model of numGaussians
+    // and to do the work after training
+    bool exhausted(long long numGaussians) const;
+
+    // Reserves time for work done after training on top of writing the PLY:
+    // renders costing about a step each, and seconds per gaussian (e.g. the tile export)
+    void reserveAfterTraining(int renders, double secondsPerGaussian);
+
+    double elapsed() const;
+    double stepSeconds() const { return stepEma; }
+private:
+    double reserve(long long numGaussians) const;
+    double stepCost(double pixels) const;
+    double costOf(int fromStep, int numSteps) const;
+
+    double seconds;
+    int maxSteps;
+    int numDownscales;
+    int resolutionSchedule;
+    int warmupLength;
+    std::chrono::steady_clock::time_point start;
+
+    int projected;
+    int baseline = 0;
+    int samples = 0;
+    double stepEma = 0.0;
+    double fullPixels = 0.0; // pixels of a render at downscale factor 1
+    int finalRenders = 0;
+    double finalPerGaussian = 2e-6; // the PLY writer
+
+    // Exponentially weighted moments of (pixels, seconds)
+    double sw = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include "validation.hpp"
+#include "model.hpp"
+#include "cv_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace{
+
+struct ValidationRun{
+    int step;
+    std::string outputDir;
+    std::vector<float> psnrs;
+    std::vector<float> ssims;
+    std::atomic<int> remaining;
+};
+
+std::mutex metricsFileMutex;
+
+void reportMetrics(const ValidationRun &run){
+    float psnrSum = 0.0f, ssimSum = 0.0f;
+    for (size_t i = 0; i < run.psnrs.size(); i++){
+        psnrSum += run.psnrs[i];
+        ssimSum += run.ssims[i];
+    }
+    const float n = static_cast<float>(run.psnrs.size());
+    std::cout << "Validation (step " << run.step << ", " << run.psnrs.size() << " cameras): PSNR "
+              << (psnrSum / n) << ", SSIM " << (ssimSum / n) << std::endl;
+
+    if (!run.outputDir.empty()){
+        std::lock_guard<std::mutex> lock(metricsFileMutex);
+        std::ofstream f((fs::path(run.outputDir) / "metrics.csv").string(), std::ios::app);
+        f << run.step << "," << (psnrSum / n) << "," << (ssimSum / n) << std::endl;
+    }
+}
+
+}
+
+void validateAsync(const std::shared_ptr<GaussianSnapshot> &snapshot, const std::vector<ValidationView> &views,
+                   int step, const std::string &outputDir, bool metrics, TaskGroup &group){
+    if (views.empty()) return;
+
+    auto run = std::make_shared<ValidationRun>();
+    run->step = step;
+    run->outputDir = outputDir;
+    run->psnrs.resize(views.size());
+    run->ssims.resize(views.size());
+    run->remaining = static_cast<int>(views.size());
+
+    for (size_t i = 0; i < views.size(); i++){
+        TaskScheduler::instance().submit(TaskPriority::SnapshotIO, [snapshot, view = views[i], run, i, metrics](){
+            torch::Tensor rgb = renderSnapshot(*snapshot, view.camera);
+
+            if (metrics){
+                SSIM ssim(11, 3);
+                run->psnrs[i] = psnr(rgb, view.gt).item<float>();
+                run->ssims[i] = ssim.eval(rgb, view.gt).item<float>();
+                if (--run->remaining == 0) reportMetrics(*run);
+            }else{
+                fs::path dir(run->outputDir);
+                std::string idx = std::to_string(view.index);
+                cv::Mat image = tensorToImage(rgb);
+                cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+                cv::imwrite((dir / (std::to_string(run->step) + "_" + idx + ".png")).string(), image);
+                cv::Mat imageGt = tensorToImage(view.gt);
+                cv::cvtColor(imageGt, imageGt, cv::COLOR_RGB2BGR);
+                cv::imwrite((dir / (std::to_string(run->step) + "_gt_" + idx + ".png")).string(), imageGt);
+            }
+        }, &group);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <torch/torch.h>
+#include "renderer.hpp"
+#include "task_scheduler.hpp"
+
+struct ValidationView{
+    int index;
+    CameraConstants camera;
+    torch::Tensor gt; // [H, W, 3] on CPU
+};
+
+// Renders a snapshot from each view on the background workers (one task per view).
+// If metrics is set, PSNR and SSIM are reported instead of writing images;
+// otherwise the render and the ground truth are written to outputDir.
+void validateAsync(const std::shared_ptr<GaussianSnapshot> &snapshot, const std::vector<ValidationView> &views,
+                   int step, const std::string &outputDir, bool metrics, TaskGroup &group);
+
+#endif